@@ -0,0 +1,342 @@
+/* SPDX-License-Identifier: ISC */
+#include "servicecmd.h"
+#include "initsock.h"
+#include "service.h"
+#include "config.h"
+
+#include <unistd.h>
+
+typedef struct {
+	char *fname;
+	char *name;
+	int type;
+	int target;
+	uint64_t start;		/* CLOCK_MONOTONIC, ns */
+	uint64_t done;		/* when dependents could go ahead, or 0 */
+	uint64_t done_boot;	/* the same in CLOCK_BOOTTIME */
+	const service_t *cfg;	/* service file, for the dependencies */
+} timeline_t;
+
+typedef struct {
+	timeline_t *entries;
+	size_t count;
+	service_list_t cfg;
+} timeline_list_t;
+
+/*
+	A service of type once holds up the boot target until it exits,
+	all others until they released their dependents.
+*/
+static int done_index(const init_timeline_t *tl)
+{
+	if (tl->type == SVC_ONCE && tl->mono[SVC_TS_FORKED] != 0)
+		return SVC_TS_EXITED;
+
+	return SVC_TS_READY;
+}
+
+static int add_entry(timeline_list_t *list, const init_timeline_t *tl)
+{
+	timeline_t *new, *ent;
+	int idx = done_index(tl);
+
+	new = realloc(list->entries, (list->count + 1) * sizeof(new[0]));
+	if (new == NULL)
+		return -1;
+
+	list->entries = new;
+	ent = new + list->count;
+	memset(ent, 0, sizeof(*ent));
+
+	ent->fname = strdup(tl->filename);
+	ent->name = strdup(tl->service_name);
+	if (ent->fname == NULL || ent->name == NULL) {
+		free(ent->fname);
+		free(ent->name);
+		return -1;
+	}
+
+	ent->type = tl->type;
+	ent->target = tl->target;
+	ent->done = tl->mono[idx];
+	ent->done_boot = tl->boot[idx];
+
+	/* services without a command are done right away */
+	ent->start = tl->mono[SVC_TS_FORKED] ?
+		tl->mono[SVC_TS_FORKED] : ent->done;
+
+	list->count += 1;
+	return 0;
+}
+
+static void cleanup_list(timeline_list_t *list)
+{
+	size_t i;
+
+	for (i = 0; i < list->count; ++i) {
+		free(list->entries[i].fname);
+		free(list->entries[i].name);
+	}
+
+	free(list->entries);
+	del_svc_list(&list->cfg);
+}
+
+static int load_timeline(timeline_list_t *list)
+{
+	init_status_reader_t rd;
+	init_timeline_t tl;
+	int fd, ret = -1;
+
+	memset(list, 0, sizeof(*list));
+
+	fd = init_socket_open();
+
+	if (fd < 0)
+		return -1;
+
+	if (init_socket_request_timeline(fd, &rd))
+		goto out;
+
+	while ((ret = init_socket_read_timeline(fd, &rd, &tl)) > 0) {
+		if (add_entry(list, &tl)) {
+			fputs("out of memory\n", stderr);
+			goto out;
+		}
+	}
+
+	if (ret < 0)
+		perror("reading from initd socket");
+out:
+	close(fd);
+	return ret;
+}
+
+static void print_duration(uint64_t ns)
+{
+	unsigned long long ms = ns / 1000000ULL;
+
+	printf("%llu.%03llus", ms / 1000, ms % 1000);
+}
+
+static int compare_duration(const void *lhs, const void *rhs)
+{
+	const timeline_t *a = lhs, *b = rhs;
+	uint64_t da = a->done - a->start, db = b->done - b->start;
+
+	if (da != db)
+		return da > db ? -1 : 1;
+
+	return strcmp(a->fname, b->fname);
+}
+
+static int cmd_blame(int argc, char **argv)
+{
+	timeline_list_t list;
+	size_t i, count = 0;
+	timeline_t *ent;
+
+	if (check_arguments(argv[0], argc, 1, 1))
+		return EXIT_FAILURE;
+
+	if (load_timeline(&list)) {
+		cleanup_list(&list);
+		return EXIT_FAILURE;
+	}
+
+	/* only keep the services that are done starting */
+	for (i = 0; i < list.count; ++i) {
+		ent = list.entries + i;
+
+		if (ent->done == 0 || ent->done < ent->start) {
+			free(ent->fname);
+			free(ent->name);
+			continue;
+		}
+
+		list.entries[count++] = *ent;
+	}
+
+	list.count = count;
+	qsort(list.entries, list.count, sizeof(list.entries[0]),
+	      compare_duration);
+
+	for (i = 0; i < list.count; ++i) {
+		ent = list.entries + i;
+
+		fputs("  ", stdout);
+		print_duration(ent->done - ent->start);
+		printf(" %s\n", ent->fname);
+	}
+
+	cleanup_list(&list);
+	return EXIT_SUCCESS;
+}
+
+static bool has_name(const char *list, int count, const char *name)
+{
+	for (; count > 0; --count, list += strlen(list) + 1) {
+		if (strcmp(list, name) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+static bool depends_on(const timeline_t *svc, const timeline_t *dep)
+{
+	if (svc->cfg != NULL &&
+	    has_name(svc->cfg->after, svc->cfg->num_after, dep->name)) {
+		return true;
+	}
+
+	return dep->cfg != NULL &&
+		has_name(dep->cfg->before, dep->cfg->num_before, svc->name);
+}
+
+static void find_configs(timeline_list_t *list)
+{
+	const service_t *svc;
+	size_t i;
+	int tgt;
+
+	for (i = 0; i < list->count; ++i) {
+		for (tgt = 0; tgt < TGT_MAX; ++tgt) {
+			svc = list->cfg.targets[tgt];
+
+			for (; svc != NULL; svc = svc->next) {
+				if (!strcmp(svc->fname, list->entries[i].fname))
+					break;
+			}
+
+			if (svc != NULL) {
+				list->entries[i].cfg = svc;
+				break;
+			}
+		}
+	}
+}
+
+/*
+	Among the dependencies of a service that were done by the time it was
+	started, find the one that was done last, i.e. the one it actually
+	had to wait for.
+*/
+static timeline_t *latest_dependency(timeline_list_t *list,
+				     const timeline_t *svc)
+{
+	timeline_t *ent, *best = NULL;
+	size_t i;
+
+	for (i = 0; i < list->count; ++i) {
+		ent = list->entries + i;
+
+		if (ent == svc || ent->done == 0 || ent->done > svc->start)
+			continue;
+
+		if (!depends_on(svc, ent))
+			continue;
+
+		if (best == NULL || ent->done > best->done)
+			best = ent;
+	}
+
+	return best;
+}
+
+static int cmd_critical_chain(int argc, char **argv)
+{
+	timeline_t *ent, *cur = NULL;
+	timeline_list_t list;
+	int depth;
+	size_t i;
+
+	if (check_arguments(argv[0], argc, 1, 2))
+		return EXIT_FAILURE;
+
+	if (load_timeline(&list))
+		goto fail;
+
+	if (svcscan(SVCDIR, &list.cfg)) {
+		fprintf(stderr, "Error while reading services from %s\n",
+			SVCDIR);
+	}
+
+	find_configs(&list);
+
+	for (i = 0; i < list.count; ++i) {
+		ent = list.entries + i;
+
+		if (ent->done == 0)
+			continue;
+
+		if (argc == 2) {
+			if (strcmp(ent->fname, argv[1]) != 0 &&
+			    strcmp(ent->name, argv[1]) != 0) {
+				continue;
+			}
+		} else if (ent->target != TGT_BOOT) {
+			continue;
+		}
+
+		if (cur == NULL || ent->done > cur->done)
+			cur = ent;
+	}
+
+	if (cur == NULL) {
+		if (argc == 2) {
+			fprintf(stderr, "%s: not started yet\n", argv[1]);
+		} else {
+			fputs("No service of the boot target is done yet\n",
+			      stderr);
+		}
+		goto fail;
+	}
+
+	puts("The time a service was done at is printed after the '@', "
+	     "the time it took\nafter the '+' character.\n");
+
+	for (depth = 0; cur != NULL; ++depth) {
+		printf("%*s%s @", 2 * depth, "", cur->fname);
+		print_duration(cur->done_boot);
+
+		if (cur->done > cur->start) {
+			fputs(" +", stdout);
+			print_duration(cur->done - cur->start);
+		}
+
+		fputc('\n', stdout);
+		cur = latest_dependency(&list, cur);
+	}
+
+	cleanup_list(&list);
+	return EXIT_SUCCESS;
+fail:
+	cleanup_list(&list);
+	return EXIT_FAILURE;
+}
+
+static command_t blame = {
+	.cmd = "blame",
+	.usage = "",
+	.s_desc = "list services by the time they took to start",
+	.l_desc = "Lists all services that finished starting, sorted by the "
+		  "time from creating their process until they were ready, "
+		  "or until they exited for services of type wait and once.",
+	.run_cmd = cmd_blame,
+};
+
+static command_t critical_chain = {
+	.cmd = "critical-chain",
+	.usage = "[service]",
+	.s_desc = "show the chain of services that held up booting",
+	.l_desc = "Starting from the service of the boot target that was "
+		  "done last, or from the given service, repeatedly shows "
+		  "the dependency that was done last before a service could "
+		  "start, i.e. the chain of services that determined how "
+		  "long booting took.",
+	.run_cmd = cmd_critical_chain,
+};
+
+REGISTER_COMMAND(blame)
+REGISTER_COMMAND(critical_chain)
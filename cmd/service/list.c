@@ -3,6 +3,18 @@
 #include "service.h"
 #include "config.h"
 
+static void print_limits(const service_t *svc)
+{
+	const char *file = svc->limits, *value;
+	int i;
+
+	for (i = 0; i < svc->num_limits; ++i) {
+		value = file + strlen(file) + 1;
+		printf("\tCgroup %s: %s\n", file, value);
+		file = value + strlen(value) + 1;
+	}
+}
+
 static void print_services(service_t *svc, const char *target)
 {
 	printf("Services for target '%s' in dependency order:\n\n", target);
@@ -11,8 +23,24 @@ static void print_services(service_t *svc, const char *target)
 		printf("%s - %s\n", svc->name, svc->desc);
 		printf("\tType: %s\n", svc_type_to_string(svc->type));
 
-		if (svc->type == SVC_RESPAWN && svc->rspwn_limit > 0)
+		if (svc->flags & SVC_FLAG_LAZY)
+			fputs("\tStart: on first connection\n", stdout);
+
+		print_limits(svc);
+
+		if (svc->type != SVC_RESPAWN)
+			continue;
+
+		if (svc->rspwn_limit > 0)
 			printf("\tRespawn limit: %d\n", svc->rspwn_limit);
+
+		printf("\tRespawn backoff: %u to %u ms\n",
+		       svc->backoff_min, svc->backoff_max);
+
+		if (svc->window_count > 0) {
+			printf("\tRespawn window: %u in %u s\n",
+			       svc->window_count, svc->window_time);
+		}
 	}
 }
 
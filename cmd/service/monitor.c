@@ -0,0 +1,174 @@
+/* SPDX-License-Identifier: ISC */
+#include "servicecmd.h"
+#include "initsock.h"
+#include "service.h"
+#include "config.h"
+
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+
+typedef struct {
+	char **names;
+	int count;
+} name_map_t;
+
+static volatile sig_atomic_t done = 0;
+
+static void sighandler(int signo)
+{
+	(void)signo;
+	done = 1;
+}
+
+static const char *state_to_string(E_SERVICE_STATE state)
+{
+	switch (state) {
+	case ESS_NONE:		return "none";
+	case ESS_RUNNING:	return "running";
+	case ESS_ENQUEUED:	return "scheduled";
+	case ESS_DONE:		return "done";
+	case ESS_FAILED:	return "failed";
+	case ESS_BACKOFF:	return "backoff";
+	case ESS_READY:		return "ready";
+	case ESS_IDLE:		return "idle";
+	}
+	return "unknown";
+}
+
+static int map_add(name_map_t *map, int id, const char *name)
+{
+	char **new;
+	int i;
+
+	if (id < 0)
+		return 0;
+
+	if (id >= map->count) {
+		new = realloc(map->names, (id + 1) * sizeof(new[0]));
+		if (new == NULL)
+			return -1;
+
+		for (i = map->count; i <= id; ++i)
+			new[i] = NULL;
+
+		map->names = new;
+		map->count = id + 1;
+	}
+
+	free(map->names[id]);
+	map->names[id] = strdup(name);
+	return map->names[id] == NULL ? -1 : 0;
+}
+
+static void map_cleanup(name_map_t *map)
+{
+	int i;
+
+	for (i = 0; i < map->count; ++i)
+		free(map->names[i]);
+
+	free(map->names);
+}
+
+static int load_names(int fd, name_map_t *map)
+{
+	init_status_reader_t rd;
+	init_status_t resp;
+	int ret;
+
+	if (init_socket_request_status(fd, &rd, ESS_NONE))
+		return -1;
+
+	while ((ret = init_socket_read_status(fd, &rd, &resp)) > 0) {
+		if (map_add(map, resp.id, resp.filename))
+			return -1;
+	}
+
+	return ret;
+}
+
+static int cmd_monitor(int argc, char **argv)
+{
+	int fd, ret = EXIT_FAILURE;
+	struct sigaction act;
+	name_map_t map;
+	init_event_t ev;
+	const char *name;
+
+	if (check_arguments(argv[0], argc, 1, 1))
+		return EXIT_FAILURE;
+
+	memset(&map, 0, sizeof(map));
+	memset(&act, 0, sizeof(act));
+	act.sa_handler = sighandler;
+	sigaction(SIGINT, &act, NULL);
+	sigaction(SIGTERM, &act, NULL);
+
+	fd = init_socket_open();
+
+	if (fd < 0)
+		return EXIT_FAILURE;
+
+	if (load_names(fd, &map)) {
+		perror("reading from initd socket");
+		goto out;
+	}
+
+	if (init_socket_send_request(fd, EIR_SUBSCRIBE))
+		goto out;
+
+	while (!done) {
+		if (init_socket_recv_event(fd, &ev)) {
+			if (errno == EINTR)
+				continue;
+			perror("reading from initd socket");
+			goto out_unsubscribe;
+		}
+
+		/* services added after we subscribed are only known by ID */
+		name = (ev.id >= 0 && ev.id < map.count) ?
+			map.names[ev.id] : NULL;
+
+		printf("[%llu.%06llu] ",
+		       (unsigned long long)(ev.timestamp / 1000000000ULL),
+		       (unsigned long long)(ev.timestamp % 1000000000ULL) / 1000);
+
+		if (name == NULL) {
+			printf("#%d", ev.id);
+		} else {
+			fputs(name, stdout);
+		}
+
+		printf(": %s -> %s", state_to_string(ev.old_state),
+		       state_to_string(ev.new_state));
+
+		if (ev.new_state == ESS_DONE || ev.new_state == ESS_FAILED ||
+		    ev.old_state == ev.new_state) {
+			printf(" (exit status %d)", ev.exit_status);
+		}
+
+		fputc('\n', stdout);
+		fflush(stdout);
+	}
+
+	ret = EXIT_SUCCESS;
+out_unsubscribe:
+	init_socket_send_request(fd, EIR_UNSUBSCRIBE);
+out:
+	map_cleanup(&map);
+	close(fd);
+	return ret;
+}
+
+static command_t monitor = {
+	.cmd = "monitor",
+	.usage = "",
+	.s_desc = "print service state changes as they happen",
+	.l_desc = "Subscribes to service state change events from the init "
+		  "daemon and prints one line for every state transition of "
+		  "a service, until interrupted.",
+	.run_cmd = cmd_monitor,
+};
+
+REGISTER_COMMAND(monitor)
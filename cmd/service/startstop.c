@@ -4,82 +4,47 @@
 #include "service.h"
 #include "config.h"
 
-#include <fnmatch.h>
-#include <getopt.h>
+#include <limits.h>
 #include <unistd.h>
 
-static int cmd_startstop(int argc, char **argv,
-			 E_SERVICE_STATE filter, E_INIT_REQUEST action)
+static int cmd_startstop(int argc, char **argv, E_INIT_REQUEST action)
 {
-	int i, fd, ret = EXIT_FAILURE;
-	init_status_t resp;
-	char tmppath[256];
-	bool found;
+	int count, fd, ret = EXIT_FAILURE;
 
-	if (check_arguments(argv[0], argc, 2, 2))
+	if (check_arguments(argv[0], argc, 2, INT_MAX))
 		return EXIT_FAILURE;
 
-	sprintf(tmppath, "/tmp/svcstatus.%d.sock", (int)getpid());
-	fd = init_socket_open(tmppath);
+	fd = init_socket_open();
 
-	if (fd < 0) {
-		unlink(tmppath);
+	if (fd < 0)
 		return EXIT_FAILURE;
-	}
-
-	if (init_socket_send_request(fd, EIR_STATUS, filter))
-		goto out;
-
-	for (;;) {
-		memset(&resp, 0, sizeof(resp));
-
-		if (init_socket_recv_status(fd, &resp)) {
-			perror("reading from initd socket");
-			free_init_status(&resp);
-			goto out;
-		}
 
-		if (resp.state == ESS_NONE) {
-			free_init_status(&resp);
-			break;
-		}
+	count = init_socket_request_match(fd, action, argv + 1, argc - 1);
 
-		found = false;
-
-		for (i = optind; i < argc; ++i) {
-			if (fnmatch(argv[i], resp.service_name, 0) == 0) {
-				found = true;
-				break;
-			}
-			if (fnmatch(argv[i], resp.filename, 0) == 0) {
-				found = true;
-				break;
-			}
-		}
-
-		if (found) {
-			if (init_socket_send_request(fd, action, resp.id))
-				goto out;
-		}
+	if (count < 0) {
+		perror("talking to initd socket");
+		goto out;
+	}
 
-		free_init_status(&resp);
+	if (count == 0) {
+		fprintf(stderr, "%s: no matching services found\n", argv[0]);
+		goto out;
 	}
 
 	ret = EXIT_SUCCESS;
 out:
 	close(fd);
-	unlink(tmppath);
 	return ret;
 }
 
 static int cmd_start(int argc, char **argv)
 {
-	return cmd_startstop(argc, argv, ESS_NONE, EIR_START);
+	return cmd_startstop(argc, argv, EIR_START_MATCH);
 }
 
 static int cmd_stop(int argc, char **argv)
 {
-	return cmd_startstop(argc, argv, ESS_NONE, EIR_STOP);
+	return cmd_startstop(argc, argv, EIR_STOP_MATCH);
 }
 
 static command_t start = {
@@ -15,12 +15,28 @@ static const struct option long_opts[] = {
 
 static const char *short_opts = "d";
 
+static void print_usage(const char *what, const svc_usage_t *usage)
+{
+	if (usage->utime == 0 && usage->stime == 0 && usage->maxrss == 0)
+		return;
+
+	printf("\tResources (%s): user %llu.%03llus, system %llu.%03llus, "
+	       "max RSS %llu KiB, page faults %llu minor, %llu major\n", what,
+	       (unsigned long long)(usage->utime / 1000000ULL),
+	       (unsigned long long)(usage->utime % 1000000ULL) / 1000,
+	       (unsigned long long)(usage->stime / 1000000ULL),
+	       (unsigned long long)(usage->stime % 1000000ULL) / 1000,
+	       (unsigned long long)usage->maxrss,
+	       (unsigned long long)usage->minflt,
+	       (unsigned long long)usage->majflt);
+}
+
 static int cmd_status(int argc, char **argv)
 {
 	bool is_tty, found, show_details = false;
 	int i, fd, ret = EXIT_FAILURE;
+	init_status_reader_t rd;
 	init_status_t resp;
-	char tmppath[256];
 	const char *state;
 	service_t *svc;
 
@@ -39,32 +55,26 @@ static int cmd_status(int argc, char **argv)
 		}
 	}
 
-	sprintf(tmppath, "/tmp/svcstatus.%d.sock", (int)getpid());
-	fd = init_socket_open(tmppath);
+	fd = init_socket_open();
 
-	if (fd < 0) {
-		unlink(tmppath);
+	if (fd < 0)
 		return EXIT_FAILURE;
-	}
 
-	if (init_socket_send_request(fd, EIR_STATUS, ESS_NONE))
+	if (init_socket_request_status(fd, &rd, ESS_NONE))
 		goto out;
 
 	is_tty = (isatty(STDOUT_FILENO) == 1);
 
 	for (;;) {
-		memset(&resp, 0, sizeof(resp));
+		i = init_socket_read_status(fd, &rd, &resp);
 
-		if (init_socket_recv_status(fd, &resp)) {
+		if (i < 0) {
 			perror("reading from initd socket");
-			free_init_status(&resp);
 			goto out;
 		}
 
-		if (resp.state == ESS_NONE) {
-			free_init_status(&resp);
+		if (i == 0)
 			break;
-		}
 
 		if (optind < argc) {
 			found = false;
@@ -81,10 +91,8 @@ static int cmd_status(int argc, char **argv)
 				}
 			}
 
-			if (!found) {
-				free_init_status(&resp);
+			if (!found)
 				continue;
-			}
 		}
 
 		switch (resp.state) {
@@ -95,9 +103,26 @@ static int cmd_status(int argc, char **argv)
 			}
 			state = "\033[22;32m UP \033[0m";
 			break;
+		case ESS_READY:
+			if (!is_tty) {
+				state = "READY";
+				break;
+			}
+			state = "\033[22;32mREADY\033[0m";
+			break;
 		case ESS_ENQUEUED:
 			state = "SCHED";
 			break;
+		case ESS_IDLE:
+			state = "IDLE";
+			break;
+		case ESS_BACKOFF:
+			if (!is_tty) {
+				state = "BACKOFF";
+				break;
+			}
+			state = "\033[22;33mBACKOFF\033[0m";
+			break;
 		case ESS_FAILED:
 			if (!is_tty) {
 				state = "FAIL";
@@ -128,6 +153,29 @@ static int cmd_status(int argc, char **argv)
 			printf("\tTemplate name: %s\n", resp.service_name);
 			printf("\tExit status: %d\n", resp.exit_status);
 
+			if (resp.signal > 0) {
+				printf("\tKilled by signal: %d (%s)%s\n",
+				       resp.signal, strsignal(resp.signal),
+				       resp.core_dumped ? ", core dumped" : "");
+			}
+
+			if (resp.run_time > 0) {
+				printf("\tLast run time: %llu.%03llus\n",
+				       (unsigned long long)(resp.run_time / 1000),
+				       (unsigned long long)(resp.run_time % 1000));
+			}
+
+			print_usage("last run", &resp.usage);
+			print_usage("all runs", &resp.total_usage);
+
+			if (resp.respawns > 0)
+				printf("\tRespawns: %u\n", resp.respawns);
+
+			if (resp.state == ESS_BACKOFF) {
+				printf("\tNext respawn in: %u.%03us\n",
+				       resp.backoff / 1000, resp.backoff % 1000);
+			}
+
 			svc = loadsvc(SVCDIR, resp.filename);
 
 			if (svc == NULL) {
@@ -140,17 +188,18 @@ static int cmd_status(int argc, char **argv)
 				       svc_target_to_string(svc->target));
 				delsvc(svc);
 			}
+		} else if (resp.state == ESS_BACKOFF) {
+			printf("[%s] %s (respawn in %u.%03us)\n", state,
+			       resp.filename, resp.backoff / 1000,
+			       resp.backoff % 1000);
 		} else {
 			printf("[%s] %s\n", state, resp.filename);
 		}
-
-		free_init_status(&resp);
 	}
 
 	ret = EXIT_SUCCESS;
 out:
 	close(fd);
-	unlink(tmppath);
 	return ret;
 }
 
@@ -0,0 +1,318 @@
+/* SPDX-License-Identifier: ISC */
+#include "servicecmd.h"
+#include "initsock.h"
+#include "service.h"
+#include "config.h"
+
+#include <unistd.h>
+
+/* what the trace knows about a service, indexed by service ID */
+typedef struct {
+	char *fname;
+	service_t *svc;		/* service file, for the command names */
+	bool named;		/* thread name emitted */
+	bool open;		/* a span is open on the track */
+} track_t;
+
+typedef struct {
+	track_t *tracks;
+	int count;
+	FILE *out;
+	bool first;		/* no event written yet */
+} trace_t;
+
+static track_t *get_track(trace_t *tr, int id)
+{
+	track_t *new;
+	int i;
+
+	if (id < 0)
+		return NULL;
+
+	if (id >= tr->count) {
+		new = realloc(tr->tracks, (id + 1) * sizeof(new[0]));
+		if (new == NULL)
+			return NULL;
+
+		for (i = tr->count; i <= id; ++i)
+			memset(new + i, 0, sizeof(new[i]));
+
+		tr->tracks = new;
+		tr->count = id + 1;
+	}
+
+	return tr->tracks + id;
+}
+
+static void cleanup_trace(trace_t *tr)
+{
+	int i;
+
+	for (i = 0; i < tr->count; ++i) {
+		free(tr->tracks[i].fname);
+		if (tr->tracks[i].svc != NULL)
+			delsvc(tr->tracks[i].svc);
+	}
+
+	free(tr->tracks);
+}
+
+static int load_names(int fd, trace_t *tr)
+{
+	init_status_reader_t rd;
+	init_status_t resp;
+	track_t *t;
+	int ret;
+
+	if (init_socket_request_status(fd, &rd, ESS_NONE))
+		return -1;
+
+	while ((ret = init_socket_read_status(fd, &rd, &resp)) > 0) {
+		t = get_track(tr, resp.id);
+		if (t == NULL)
+			continue;
+
+		free(t->fname);
+		t->fname = strdup(resp.filename);
+		if (t->fname == NULL)
+			return -1;
+	}
+
+	return ret;
+}
+
+static void write_string(FILE *out, const char *str)
+{
+	fputc('"', out);
+
+	for (; *str != '\0'; ++str) {
+		if (*str == '"' || *str == '\\') {
+			fprintf(out, "\\%c", *str);
+		} else if ((unsigned char)*str < 0x20) {
+			fprintf(out, "\\u%04x", (unsigned char)*str);
+		} else {
+			fputc(*str, out);
+		}
+	}
+
+	fputc('"', out);
+}
+
+/* start a trace event, the caller adds fields and closes it */
+static void begin_event(trace_t *tr, const char *ph, const char *name,
+			int id, uint64_t timestamp)
+{
+	fputs(tr->first ? "\n" : ",\n", tr->out);
+	tr->first = false;
+
+	fprintf(tr->out, "{\"ph\":\"%s\",\"pid\":1,\"tid\":%d,", ph, id);
+
+	if (name != NULL) {
+		fputs("\"name\":", tr->out);
+		write_string(tr->out, name);
+		fputc(',', tr->out);
+	}
+
+	fprintf(tr->out, "\"ts\":%llu.%03llu",
+		(unsigned long long)(timestamp / 1000ULL),
+		(unsigned long long)(timestamp % 1000ULL));
+}
+
+static void name_track(trace_t *tr, track_t *t, int id, uint64_t timestamp)
+{
+	char buffer[32];
+
+	if (t->named)
+		return;
+
+	t->named = true;
+
+	/* services added after we fetched the names are only known by ID */
+	if (t->fname == NULL)
+		sprintf(buffer, "#%d", id);
+
+	begin_event(tr, "M", "thread_name", id, timestamp);
+	fputs(",\"args\":{\"name\":", tr->out);
+	write_string(tr->out, t->fname != NULL ? t->fname : buffer);
+	fputs("}}", tr->out);
+
+	if (t->fname != NULL)
+		t->svc = loadsvc(SVCDIR, t->fname);
+}
+
+static void close_span(trace_t *tr, track_t *t, int id, uint64_t timestamp)
+{
+	if (!t->open)
+		return;
+
+	begin_event(tr, "E", NULL, id, timestamp);
+	fputc('}', tr->out);
+	t->open = false;
+}
+
+static void open_span(trace_t *tr, track_t *t, const init_history_t *ev,
+		      const char *name)
+{
+	close_span(tr, t, ev->id, ev->timestamp);
+	begin_event(tr, "B", name, ev->id, ev->timestamp);
+	t->open = true;
+}
+
+static void instant(trace_t *tr, const init_history_t *ev, const char *name)
+{
+	begin_event(tr, "i", name, ev->id, ev->timestamp);
+	fputs(",\"s\":\"t\"", tr->out);
+}
+
+static const char *command_name(const track_t *t, unsigned int index)
+{
+	const exec_t *e;
+
+	if (t->svc == NULL)
+		return NULL;
+
+	for (e = t->svc->exec; e != NULL && index > 0; e = e->next)
+		--index;
+
+	return e == NULL ? NULL : e->args;
+}
+
+static void write_event(trace_t *tr, const init_history_t *ev)
+{
+	const char *cmd;
+	char name[256];
+	track_t *t;
+
+	t = get_track(tr, ev->id);
+	if (t == NULL)
+		return;
+
+	name_track(tr, t, ev->id, ev->timestamp);
+
+	switch (ev->event) {
+	case EHE_ENQUEUED:
+		open_span(tr, t, ev, "waiting for dependencies");
+		fputc('}', tr->out);
+		break;
+	case EHE_EXEC_START:
+		cmd = command_name(t, ev->index);
+		if (cmd == NULL) {
+			snprintf(name, sizeof(name), "command %u", ev->index);
+		} else {
+			snprintf(name, sizeof(name), "%s", cmd);
+		}
+
+		open_span(tr, t, ev, name);
+		fprintf(tr->out, ",\"args\":{\"index\":%u}}", ev->index);
+		break;
+	case EHE_EXEC_END:
+		if (!t->open)
+			break;
+
+		begin_event(tr, "E", NULL, ev->id, ev->timestamp);
+		fprintf(tr->out, ",\"args\":{\"status\":%d}}", ev->value);
+		t->open = false;
+		break;
+	case EHE_READY:
+		instant(tr, ev, "ready");
+		fputc('}', tr->out);
+		break;
+	case EHE_BACKOFF:
+		open_span(tr, t, ev, "respawn backoff");
+		fprintf(tr->out, ",\"args\":{\"delay_ms\":%d}}", ev->value);
+		break;
+	case EHE_STOP:
+		instant(tr, ev, "stop requested");
+		fputc('}', tr->out);
+		break;
+	case EHE_IDLE:
+		open_span(tr, t, ev, "idle");
+		fputc('}', tr->out);
+		break;
+	case EHE_EXITED:
+		close_span(tr, t, ev->id, ev->timestamp);
+		instant(tr, ev, "exited");
+		fprintf(tr->out, ",\"args\":{\"status\":%d}}", ev->value);
+		break;
+	}
+}
+
+static int cmd_trace(int argc, char **argv)
+{
+	int fd, ret = EXIT_FAILURE;
+	init_status_reader_t rd;
+	init_history_t ev;
+	trace_t tr;
+	int i;
+
+	if (check_arguments(argv[0], argc, 1, 2))
+		return EXIT_FAILURE;
+
+	memset(&tr, 0, sizeof(tr));
+	tr.first = true;
+
+	fd = init_socket_open();
+
+	if (fd < 0)
+		return EXIT_FAILURE;
+
+	if (load_names(fd, &tr)) {
+		perror("reading from initd socket");
+		goto out;
+	}
+
+	if (argc == 2) {
+		tr.out = fopen(argv[1], "w");
+		if (tr.out == NULL) {
+			perror(argv[1]);
+			goto out;
+		}
+	} else {
+		tr.out = stdout;
+	}
+
+	if (init_socket_request_history(fd, &rd))
+		goto out_close;
+
+	fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", tr.out);
+
+	while ((i = init_socket_read_history(fd, &rd, &ev)) > 0)
+		write_event(&tr, &ev);
+
+	fputs("\n]}\n", tr.out);
+
+	if (i < 0) {
+		perror("reading from initd socket");
+		goto out_close;
+	}
+
+	ret = EXIT_SUCCESS;
+out_close:
+	if (tr.out != stdout) {
+		if (fclose(tr.out) != 0 && ret == EXIT_SUCCESS) {
+			perror(argv[1]);
+			ret = EXIT_FAILURE;
+		}
+	} else {
+		fflush(stdout);
+	}
+out:
+	cleanup_trace(&tr);
+	close(fd);
+	return ret;
+}
+
+static command_t trace = {
+	.cmd = "trace",
+	.usage = "[file]",
+	.s_desc = "dump the supervision history as a Chrome trace",
+	.l_desc = "Fetches the recent supervision history from the init daemon "
+		  "and writes it to the given file, or standard output, in "
+		  "the Chrome trace event JSON format, which can be viewed "
+		  "with Perfetto or chrome://tracing. Every service gets a "
+		  "track, with spans for waiting on dependencies, each "
+		  "command of the exec block and respawn delays.",
+	.run_cmd = cmd_trace,
+};
+
+REGISTER_COMMAND(trace)
@@ -0,0 +1,223 @@
+/* SPDX-License-Identifier: ISC */
+#include <sys/wait.h>
+#include <getopt.h>
+#include <limits.h>
+#include <ctype.h>
+#include <time.h>
+
+#include "init.h"
+
+/*
+	Starts a command over and over again through runsvc, the same way
+	init starts services, once with every spawn backend. Optionally,
+	some memory is touched first, since forking gets slower the more
+	memory the parent has mapped.
+*/
+
+static const struct option options[] = {
+	{ "help", no_argument, NULL, 'h' },
+	{ "count", required_argument, NULL, 'n' },
+	{ "memory", required_argument, NULL, 'm' },
+	{ NULL, 0, NULL, 0 },
+};
+
+/* stop at the command, so its options are left alone */
+static const char *shortopt = "+hn:m:";
+
+static const struct {
+	const char *name;
+	int type;
+} backends[] = {
+	{ "fork", SPAWN_FORK },
+	{ "vfork", SPAWN_VFORK },
+};
+
+static __attribute__((noreturn)) void usage(const char *progname, int status)
+{
+	fprintf(status == EXIT_SUCCESS ? stdout : stderr,
+"%s [OPTIONS...] [COMMAND [ARGS...]]\n\n"
+"Measure how fast service processes are spawned with each backend.\n"
+"The command defaults to 'true'.\n\n"
+"   -h, --help          Display this help text and exit.\n"
+"   -n, --count <n>     Number of processes to spawn per backend.\n"
+"                       Defaults to 1000.\n"
+"   -m, --memory <MiB>  Touch this much memory before starting, to\n"
+"                       simulate a larger init process.\n",
+		progname);
+	exit(status);
+}
+
+static int strtoui(const char *str)
+{
+	int i = 0;
+
+	if (!isdigit(*str))
+		return -1;
+
+	while (isdigit(*str)) {
+		if (i > (INT_MAX / 10))
+			return -1;
+
+		i = i * 10 + (*(str++)) - '0';
+	}
+
+	if (*str != '\0')
+		return -1;
+
+	return i;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static exec_t *make_exec(int argc, char **argv)
+{
+	size_t size = 0;
+	exec_t *e;
+	char *ptr;
+	int i;
+
+	for (i = 0; i < argc; ++i)
+		size += strlen(argv[i]) + 1;
+
+	e = calloc(1, sizeof(*e) + size);
+	if (e == NULL) {
+		perror("spawnbench");
+		return NULL;
+	}
+
+	e->argc = argc;
+
+	for (ptr = e->args, i = 0; i < argc; ++i)
+		ptr = stpcpy(ptr, argv[i]) + 1;
+
+	return e;
+}
+
+/* the latency is the time runsvc takes until it returns to its caller */
+static int run_backend(const char *name, service_t *svc, int count)
+{
+	uint64_t start, begin, lat, lat_min = UINT64_MAX, lat_max = 0;
+	uint64_t lat_sum = 0, total;
+	int i, status, pidfd;
+	pid_t pid;
+
+	begin = now_ns();
+
+	for (i = 0; i < count; ++i) {
+		start = now_ns();
+		pid = runsvc(svc, svc->exec, &pidfd);
+		lat = now_ns() - start;
+
+		if (pid == -1)
+			return -1;
+
+		if (pidfd >= 0)
+			close(pidfd);
+
+		while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+			;
+
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+			fprintf(stderr, "%s: command failed\n", name);
+			return -1;
+		}
+
+		lat_sum += lat;
+		if (lat < lat_min)
+			lat_min = lat;
+		if (lat > lat_max)
+			lat_max = lat;
+	}
+
+	total = now_ns() - begin;
+
+	printf("%-6s %10.1f %10.1f %10.1f %10.1f\n", name,
+	       (double)count * 1e9 / (double)total,
+	       (double)lat_sum / count / 1000.0,
+	       (double)lat_min / 1000.0, (double)lat_max / 1000.0);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	char *defcmd[] = { (char *)"true" };
+	int c, count = 1000, memory = 0;
+	size_t i, size;
+	service_t *svc;
+	char *mem;
+
+	for (;;) {
+		c = getopt_long(argc, argv, shortopt, options, NULL);
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 'h':
+			usage(argv[0], EXIT_SUCCESS);
+		case 'n':
+			count = strtoui(optarg);
+			if (count <= 0)
+				usage(argv[0], EXIT_FAILURE);
+			break;
+		case 'm':
+			memory = strtoui(optarg);
+			if (memory < 0)
+				usage(argv[0], EXIT_FAILURE);
+			break;
+		default:
+			usage(argv[0], EXIT_FAILURE);
+		}
+	}
+
+	if (memory > 0) {
+		size = (size_t)memory * 1024 * 1024;
+		mem = malloc(size);
+		if (mem == NULL) {
+			perror("spawnbench");
+			return EXIT_FAILURE;
+		}
+
+		for (i = 0; i < size; i += 4096)
+			mem[i] = 1;
+	}
+
+	svc = calloc(1, sizeof(*svc) + 1);
+	if (svc == NULL) {
+		perror("spawnbench");
+		return EXIT_FAILURE;
+	}
+
+	svc->fname = (char *)"spawnbench";
+	svc->pidfd = -1;
+	svc->notify_fd[0] = -1;
+	svc->notify_fd[1] = -1;
+	svc->cgroup_fd = -1;
+	svc->cgroup_events = -1;
+
+	if (optind < argc) {
+		svc->exec = make_exec(argc - optind, argv + optind);
+	} else {
+		svc->exec = make_exec(1, defcmd);
+	}
+
+	if (svc->exec == NULL || runsvc_reload_env())
+		return EXIT_FAILURE;
+
+	printf("%-6s %10s %10s %10s %10s\n", "", "spawns/s",
+	       "avg us", "min us", "max us");
+
+	for (i = 0; i < sizeof(backends) / sizeof(backends[0]); ++i) {
+		runsvc_set_backend(backends[i].type);
+
+		if (run_backend(backends[i].name, svc, count))
+			return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,331 @@
+/* SPDX-License-Identifier: ISC */
+#include <time.h>
+
+#include "init.h"
+
+/* maximum number of bytes queued for a single client */
+#define CLIENT_QUEUE_MAX (256 * 1024)
+
+/* maximum number of bytes queued for all clients together */
+#define TOTAL_QUEUE_MAX (1024 * 1024)
+
+/* time after which a stalled datagram client is given up on */
+#define DGRAM_TIMEOUT_MS 5000
+
+/* interval for retrying to send queued datagrams */
+#define DGRAM_RETRY_MS 50
+
+typedef struct outmsg_t {
+	struct outmsg_t *next;
+	size_t size;
+	uint8_t data[];
+} outmsg_t;
+
+static ctlclient_t *connections = NULL;
+static ctlclient_t *datagrams = NULL;
+static int num_connections = 0;
+static size_t total_queued = 0;
+
+static ctlclient_t *client_create(int fd)
+{
+	ctlclient_t *cl = calloc(1, sizeof(*cl));
+
+	if (cl == NULL) {
+		perror("allocating control socket client");
+		return NULL;
+	}
+
+	cl->fd = fd;
+	cl->tail = &cl->head;
+	return cl;
+}
+
+static void client_unlink(ctlclient_t **list, ctlclient_t *cl)
+{
+	while (*list != NULL && *list != cl)
+		list = &(*list)->next;
+
+	if (*list != NULL)
+		*list = cl->next;
+}
+
+static void client_discard_queue(ctlclient_t *cl)
+{
+	outmsg_t *msg;
+
+	while (cl->head != NULL) {
+		msg = cl->head;
+		cl->head = msg->next;
+		free(msg);
+	}
+
+	cl->tail = &cl->head;
+	total_queued -= cl->queued;
+	cl->queued = 0;
+}
+
+static void client_destroy(ctlclient_t *cl)
+{
+	client_discard_queue(cl);
+	free(cl);
+}
+
+static bool would_block(int err)
+{
+	return err == EAGAIN || err == ENOBUFS;
+}
+
+static ssize_t client_send_now(ctlclient_t *cl, const void *data, size_t size)
+{
+	ssize_t ret;
+retry:
+	if (cl->addrlen > 0) {
+		ret = sendto(cl->fd, data, size, MSG_DONTWAIT | MSG_NOSIGNAL,
+			     (const struct sockaddr *)&cl->addr, cl->addrlen);
+	} else {
+		ret = send(cl->fd, data, size, MSG_DONTWAIT | MSG_NOSIGNAL);
+	}
+
+	if (ret < 0 && errno == EINTR)
+		goto retry;
+
+	return ret;
+}
+
+static long elapsed_ms(const struct timespec *since)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - since->tv_sec) * 1000L +
+	       (now.tv_nsec - since->tv_nsec) / 1000000L;
+}
+
+ctlclient_t *ctlclient_accept(int listenfd, evloop_handler_t handler)
+{
+	struct ucred cred;
+	ctlclient_t *cl;
+	socklen_t len;
+	int fd;
+
+	fd = accept4(listenfd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+	if (fd < 0)
+		return NULL;
+
+	/* abstract sockets have no permissions, only talk to root */
+	len = sizeof(cred);
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0 ||
+	    cred.uid != 0 || num_connections == INIT_MAX_CLIENTS) {
+		close(fd);
+		return NULL;
+	}
+
+	cl = client_create(fd);
+	if (cl == NULL) {
+		close(fd);
+		return NULL;
+	}
+
+	if (evloop_add(fd, EPOLLIN, handler, cl)) {
+		client_destroy(cl);
+		close(fd);
+		return NULL;
+	}
+
+	cl->next = connections;
+	connections = cl;
+	num_connections += 1;
+	return cl;
+}
+
+ctlclient_t *ctlclient_datagram(int fd, const struct sockaddr_un *addr,
+				socklen_t addrlen)
+{
+	ctlclient_t *cl;
+
+	if (addrlen > sizeof(*addr))
+		return NULL;
+
+	/* keep replies in order if there is still something queued */
+	for (cl = datagrams; cl != NULL; cl = cl->next) {
+		if (cl->fd == fd && cl->addrlen == addrlen &&
+		    memcmp(&cl->addr, addr, addrlen) == 0) {
+			cl->refs += 1;
+			return cl;
+		}
+	}
+
+	cl = client_create(fd);
+	if (cl == NULL)
+		return NULL;
+
+	memcpy(&cl->addr, addr, addrlen);
+	cl->addrlen = addrlen;
+	cl->refs = 1;
+	cl->next = datagrams;
+	datagrams = cl;
+	return cl;
+}
+
+/*
+	A subscriber can get an event while its own request is still being
+	handled, so the client must outlive every user, not just the first.
+*/
+void ctlclient_release(ctlclient_t *cl)
+{
+	if (cl->addrlen == 0)
+		return;
+
+	cl->refs -= 1;
+
+	if (cl->refs == 0 && (cl->dead || cl->head == NULL)) {
+		client_unlink(&datagrams, cl);
+		client_destroy(cl);
+	}
+}
+
+void ctlclient_close(ctlclient_t *cl)
+{
+	if (cl->addrlen > 0) {
+		client_unlink(&datagrams, cl);
+	} else {
+		svcevent_unsubscribe(cl);
+		evloop_remove(cl->fd);
+		client_unlink(&connections, cl);
+		num_connections -= 1;
+		close(cl->fd);
+	}
+
+	client_destroy(cl);
+}
+
+int ctlclient_send(ctlclient_t *cl, const void *data, size_t size)
+{
+	outmsg_t *msg;
+	ssize_t ret;
+
+	if (cl->dead)
+		return -1;
+
+	if (cl->head == NULL) {
+		ret = client_send_now(cl, data, size);
+
+		if (ret >= 0)
+			return 0;
+
+		if (!would_block(errno))
+			goto fail;
+
+		clock_gettime(CLOCK_MONOTONIC, &cl->stalled);
+
+		if (cl->addrlen == 0)
+			evloop_modify(cl->fd, EPOLLIN | EPOLLOUT);
+	}
+
+	/* drop policy: a client that falls too far behind is given up on */
+	if (cl->queued + size > CLIENT_QUEUE_MAX ||
+	    total_queued + size > TOTAL_QUEUE_MAX) {
+		goto fail;
+	}
+
+	msg = malloc(sizeof(*msg) + size);
+	if (msg == NULL)
+		goto fail;
+
+	msg->next = NULL;
+	msg->size = size;
+	memcpy(msg->data, data, size);
+
+	*(cl->tail) = msg;
+	cl->tail = &msg->next;
+	cl->queued += size;
+	total_queued += size;
+	return 0;
+fail:
+	cl->dead = true;
+	client_discard_queue(cl);
+	return -1;
+}
+
+int ctlclient_flush(ctlclient_t *cl)
+{
+	bool pending = cl->head != NULL;
+	outmsg_t *msg;
+
+	while (!cl->dead && cl->head != NULL) {
+		msg = cl->head;
+
+		if (client_send_now(cl, msg->data, msg->size) < 0) {
+			if (would_block(errno))
+				return 0;
+
+			cl->dead = true;
+			client_discard_queue(cl);
+			return -1;
+		}
+
+		cl->head = msg->next;
+		if (cl->head == NULL)
+			cl->tail = &cl->head;
+
+		clock_gettime(CLOCK_MONOTONIC, &cl->stalled);
+
+		cl->queued -= msg->size;
+		total_queued -= msg->size;
+		free(msg);
+	}
+
+	/* only stop waiting for room if there was something queued */
+	if (pending && !cl->dead && cl->addrlen == 0)
+		evloop_modify(cl->fd, EPOLLIN);
+
+	return cl->dead ? -1 : 0;
+}
+
+void ctlclient_reap(void)
+{
+	ctlclient_t *cl, *next;
+
+	for (cl = connections; cl != NULL; cl = next) {
+		next = cl->next;
+
+		if (cl->dead)
+			ctlclient_close(cl);
+	}
+}
+
+/*
+	Writability of a datagram socket does not tell whether a specific
+	peer can take more data, so queued datagrams are retried in regular
+	intervals instead.
+*/
+int ctlclient_poll_timeout(void)
+{
+	return datagrams == NULL ? -1 : DGRAM_RETRY_MS;
+}
+
+void ctlclient_flush_datagrams(void)
+{
+	ctlclient_t *cl, *next;
+
+	for (cl = datagrams; cl != NULL; cl = next) {
+		next = cl->next;
+
+		ctlclient_flush(cl);
+
+		if (cl->head != NULL && elapsed_ms(&cl->stalled) >
+		    DGRAM_TIMEOUT_MS) {
+			cl->dead = true;
+		}
+
+		/* a subscriber that stopped reading gets no more events */
+		if (cl->dead)
+			svcevent_unsubscribe(cl);
+
+		if (cl->refs == 0 && (cl->dead || cl->head == NULL)) {
+			client_unlink(&datagrams, cl);
+			client_destroy(cl);
+		}
+	}
+}
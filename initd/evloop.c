@@ -0,0 +1,156 @@
+/* SPDX-License-Identifier: ISC */
+#include "init.h"
+
+#define MAX_EVENTS 32
+
+typedef struct evsource_t {
+	struct evsource_t *next;	/* on the removed list */
+	int fd;				/* -1 once removed */
+	evloop_handler_t handler;
+	void *arg;
+} evsource_t;
+
+static int epfd = -1;
+
+/* registered sources, indexed by file descriptor */
+static evsource_t **by_fd = NULL;
+static int by_fd_size = 0;
+
+/*
+	Sources removed while dispatching may still be referenced by
+	events later in the same batch, so they are freed afterwards.
+*/
+static evsource_t *removed = NULL;
+
+static evsource_t *find_source(int fd)
+{
+	return (fd >= 0 && fd < by_fd_size) ? by_fd[fd] : NULL;
+}
+
+static int grow_table(int fd)
+{
+	evsource_t **new;
+	int size;
+
+	if (fd < by_fd_size)
+		return 0;
+
+	size = by_fd_size > 0 ? by_fd_size : 64;
+	while (size <= fd)
+		size *= 2;
+
+	new = realloc(by_fd, sizeof(by_fd[0]) * size);
+	if (new == NULL) {
+		perror("growing event source table");
+		return -1;
+	}
+
+	memset(new + by_fd_size, 0, sizeof(by_fd[0]) * (size - by_fd_size));
+	by_fd = new;
+	by_fd_size = size;
+	return 0;
+}
+
+int evloop_init(void)
+{
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd < 0) {
+		perror("epoll_create1");
+		return -1;
+	}
+
+	return 0;
+}
+
+int evloop_add(int fd, uint32_t events, evloop_handler_t handler, void *arg)
+{
+	struct epoll_event ev;
+	evsource_t *src;
+
+	if (fd < 0 || grow_table(fd))
+		return -1;
+
+	src = calloc(1, sizeof(*src));
+	if (src == NULL) {
+		perror("registering event source");
+		return -1;
+	}
+
+	src->fd = fd;
+	src->handler = handler;
+	src->arg = arg;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.ptr = src;
+
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev)) {
+		perror("epoll_ctl");
+		free(src);
+		return -1;
+	}
+
+	by_fd[fd] = src;
+	return 0;
+}
+
+int evloop_modify(int fd, uint32_t events)
+{
+	struct epoll_event ev;
+	evsource_t *src;
+
+	src = find_source(fd);
+	if (src == NULL)
+		return -1;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.ptr = src;
+
+	return epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev);
+}
+
+void evloop_remove(int fd)
+{
+	evsource_t *src = find_source(fd);
+
+	if (src == NULL)
+		return;
+
+	by_fd[fd] = NULL;
+	epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+
+	src->fd = -1;
+	src->next = removed;
+	removed = src;
+}
+
+int evloop_dispatch(int timeout)
+{
+	struct epoll_event events[MAX_EVENTS];
+	evsource_t *src;
+	int i, count;
+
+	count = epoll_wait(epfd, events, MAX_EVENTS, timeout);
+
+	if (count < 0) {
+		if (errno != EINTR)
+			perror("epoll_wait");
+		return -1;
+	}
+
+	for (i = 0; i < count; ++i) {
+		src = events[i].data.ptr;
+
+		if (src->fd >= 0)
+			src->handler(src->fd, events[i].events, src->arg);
+	}
+
+	while (removed != NULL) {
+		src = removed;
+		removed = src->next;
+		free(src);
+	}
+
+	return count;
+}
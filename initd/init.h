@@ -12,12 +12,13 @@
 #include <endian.h>
 #include <stdio.h>
 #include <errno.h>
-#include <poll.h>
+#include <sys/epoll.h>
 
 #include <linux/reboot.h>
 #include <sys/signalfd.h>
 #include <sys/reboot.h>
 #include <stdbool.h>
+#include <fcntl.h>
 #include <signal.h>
 
 #include "initsock.h"
@@ -25,8 +26,70 @@
 #include "config.h"
 
 #define ENVFILE ETCPATH "/initd.env"
+
+/*
+	First file descriptor passed to a service: its listening sockets,
+	followed by the readiness notification pipe.
+*/
+#define LISTEN_FDS_START 3
 #define PROCFDDIR "/proc/self/fd"
 
+enum {
+	SVC_TABLE_PID = 0,
+	SVC_TABLE_FNAME,
+	SVC_TABLE_NAME,
+};
+
+/*
+	An open addressing hash table of services, keyed either by the pid
+	of the running service process, by the service file name or by the
+	(not necessarily unique) canonical service name. The table does not
+	own the services.
+*/
+typedef struct {
+	service_t **slots;
+	size_t mask;		/* number of slots - 1, always a power of 2 */
+	size_t count;
+	int type;		/* SVC_TABLE_* key type */
+} svc_table_t;
+
+#define SVC_TABLE_INIT(key) { NULL, 0, 0, (key) }
+
+/*
+	A client of the control sockets, either a connection to the
+	SOCK_SEQPACKET socket or the peer address of a datagram request.
+	Replies are sent without blocking. If a client cannot take them
+	right away, they are queued and sent once it can. Clients that fall
+	too far behind are marked dead and their queue is discarded.
+*/
+typedef struct ctlclient_t {
+	struct ctlclient_t *next;
+	int fd;
+	struct sockaddr_un addr;	/* peer of a datagram client */
+	socklen_t addrlen;		/* 0 for connections */
+	int refs;			/* users of a datagram client */
+	bool dead;
+
+	struct outmsg_t *head;		/* queued replies */
+	struct outmsg_t **tail;
+	size_t queued;			/* number of queued bytes */
+	struct timespec stalled;	/* last time the queue made progress */
+} ctlclient_t;
+
+/* an event in the supervision history, see init_history_record_t */
+typedef struct {
+	uint64_t timestamp;	/* CLOCK_MONOTONIC, nanoseconds */
+	int id;
+	uint8_t event;		/* EHE_* */
+	uint16_t index;
+	int value;
+} history_entry_t;
+
+enum {
+	SPAWN_FORK = 0,
+	SPAWN_VFORK,
+};
+
 enum {
 	STATUS_OK = 0,
 	STATUS_FAIL,
@@ -41,11 +104,39 @@ void target_completed(int target);
 /********** runsvc.c **********/
 
 /*
-	Invoke the runsvc command to execute the comands of a service.
+	Start a process that executes a single command of a service, with
+	the environment read from the environment file and standard I/O
+	redirected to the controlling tty of the service, if it has one.
 
-	Returns the pid of the child process containing the runsvc instance.
+	Returns the pid of the child process, or -1 on failure. If the
+	kernel supports it, a pidfd referring to the child is returned
+	through pidfd, otherwise it is set to -1.
 */
-pid_t runsvc(service_t *svc);
+pid_t runsvc(service_t *svc, exec_t *e, int *pidfd);
+
+/*
+	Build the argument vectors of all commands of a service and resolve
+	their executables in the PATH of the service environment, reporting
+	commands that cannot be found. This is done again before a command
+	is started if the environment has been reloaded since.
+	Returns 0 on success, -1 on failure.
+*/
+int runsvc_prepare(service_t *svc);
+
+/*
+	Select how service processes are created. With SPAWN_VFORK (the
+	default), commands are started from a child that shares the address
+	space of init and is suspended until the command is executed.
+	SPAWN_FORK always uses a regular fork.
+*/
+void runsvc_set_backend(int type);
+
+/*
+	(Re)read the environment file into the prebuilt environment that is
+	handed to all service processes. If reading fails, the previous
+	environment is kept. Returns 0 on success, -1 on failure.
+*/
+int runsvc_reload_env(void);
 
 /********** status.c **********/
 
@@ -55,35 +146,330 @@ pid_t runsvc(service_t *svc);
 
 	A new-line is appended to the mssage, UNLESS type is STATUS_WAIT.
 
-	If update is true, print a carriage return first to overwrite the
-	current line (e.g. after a STATUS_WAIT message).
+	If update is true and the current line is a STATUS_WAIT message for
+	the same msg, print a carriage return first to overwrite it.
+	Otherwise, a pending STATUS_WAIT line is terminated first.
 */
 void print_status(const char *msg, int type, bool update);
 
 /********** supervisor.c **********/
 
-void supervisor_handle_exited(pid_t pid, int status);
+/*
+	Collect the exit status of a child process through the slow path,
+	i.e. if its pidfd has not been handled yet or it has none. Returns
+	false if the child does not belong to a service.
+*/
+bool supervisor_handle_exited(pid_t pid);
 
 void supervisor_set_target(int next);
 
-void supervisor_init(void);
+/* Called once a running service reports that it is ready. */
+void supervisor_service_ready(service_t *svc);
+
+/* Called once a client shows up on a socket of an idle lazy service. */
+void supervisor_service_activated(service_t *svc);
+
+/* Called once the last process in the cgroup of a service is gone. */
+void supervisor_service_gone(service_t *svc);
+
+/* Milliseconds until a service waiting to be respawned is started again. */
+unsigned int supervisor_respawn_delay(const service_t *svc);
+
+/*
+	Read the service configuration and enqueue the boot target. If
+	serial is true, services are started strictly one after another in
+	dependency order, instead of starting every service as soon as its
+	own dependencies are satisfied.
+*/
+void supervisor_init(bool serial);
 
 bool supervisor_process_queues(void);
 
 void supervisor_reload_config(void);
 
-void supervisor_answer_status_request(int fd, const void *dest_addr,
-				      size_t addrlen, E_SERVICE_STATE filter);
+/*
+	Re-read a single service file from the service directory (or notice
+	that it was removed) and apply the difference to the supervisor
+	state. Services that are currently running keep their old
+	configuration.
+*/
+void supervisor_reload_service(int dirfd, const char *fname);
+
+void supervisor_answer_status_request(ctlclient_t *cl, E_SERVICE_STATE filter,
+				      int version);
+
+/* Send the recorded transition times of all supervised services. */
+void supervisor_answer_timeline_request(ctlclient_t *cl);
 
 void supervisor_start(int id);
 
+/*
+	Start or stop (depending on rq, either EIR_START_MATCH or
+	EIR_STOP_MATCH) all services whose file name or service name
+	matches one of count packed, null-terminated shell glob patterns.
+	Returns the number of matching services.
+*/
+int supervisor_startstop_match(int rq, const char *patterns, int count);
+
 void supervisor_stop(int id);
 
+/********** svctable.c **********/
+
+/*
+	Add a service to a table. The key (pid or fname) must not be
+	modified while the service is in the table.
+
+	Returns 0 on success, -1 if the table could not be grown.
+*/
+int svc_table_insert(svc_table_t *tbl, service_t *svc);
+
+void svc_table_remove(svc_table_t *tbl, service_t *svc);
+
+service_t *svc_table_find_pid(const svc_table_t *tbl, pid_t pid);
+
+service_t *svc_table_find_fname(const svc_table_t *tbl, const char *fname);
+
+/*
+	Iterate over all services with the given canonical name. The
+	iterator pos must be initialized to 0 before the first call.
+	Returns NULL once all matching services have been visited.
+*/
+service_t *svc_table_find_name(const svc_table_t *tbl, const char *name,
+			       size_t *pos);
+
+void svc_table_cleanup(svc_table_t *tbl);
+
+/********** evloop.c **********/
+
+typedef void (*evloop_handler_t)(int fd, uint32_t events, void *arg);
+
+int evloop_init(void);
+
+/* Register a file descriptor to be watched for the given epoll events. */
+int evloop_add(int fd, uint32_t events, evloop_handler_t handler, void *arg);
+
+/* Change the set of events a registered file descriptor is watched for. */
+int evloop_modify(int fd, uint32_t events);
+
+/*
+	Stop watching a file descriptor. Safe to call from within a handler,
+	including for the descriptor currently being handled.
+*/
+void evloop_remove(int fd);
+
+/*
+	Wait up to timeout milliseconds (-1 for no limit) for events and call
+	the handlers of the sources that are ready. Returns the number of
+	events handled or -1 on failure.
+*/
+int evloop_dispatch(int timeout);
+
+/********** svcwatch.c **********/
+
+/*
+	Set up an inotify instance that watches the service directory and
+	the directories containing the template files that the service
+	symlinks point to.
+
+	Returns the inotify file descriptor or -1 on failure.
+*/
+int svcwatch_init(void);
+
+/*
+	Read all pending events from the inotify descriptor and reload the
+	service files that were added, removed or modified.
+*/
+void svcwatch_handle(int fd);
+
 /********** initsock.c **********/
 
 int init_socket_create(void);
 
-int init_socket_send_status(int fd, const void *dest_addr, size_t addrlen,
-			    E_SERVICE_STATE state, service_t *svc);
+/*
+	Create the listening SOCK_SEQPACKET control socket in the abstract
+	namespace. Requests received on a connection are answered on the
+	same connection.
+*/
+int init_socket_create_listener(void);
+
+int init_socket_send_status(ctlclient_t *cl, E_SERVICE_STATE state,
+			    service_t *svc);
+
+int init_socket_send_match(ctlclient_t *cl, int count);
+
+/*
+	Accumulates the services of a status reply. For a batched request
+	(version > 0), the services are packed into as few datagrams as
+	possible. For version 0, every service is sent individually using
+	init_socket_send_status.
+*/
+typedef struct {
+	ctlclient_t *cl;
+	int version;
+
+	size_t size;
+	unsigned int count;
+	uint8_t buffer[INIT_STATUS_BATCH_MAX];
+} status_writer_t;
+
+void init_status_writer_init(status_writer_t *w, ctlclient_t *cl, int version);
+
+int init_status_writer_add(status_writer_t *w, E_SERVICE_STATE state,
+			   service_t *svc);
+
+/* map a state to the closest one known to the version of the writer */
+E_SERVICE_STATE init_status_writer_state(const status_writer_t *w,
+					 E_SERVICE_STATE state);
+
+/*
+	Add the recorded transition times of a service to a writer that was
+	set up with version INIT_TIMELINE_VERSION.
+*/
+int init_timeline_writer_add(status_writer_t *w, E_SERVICE_STATE state,
+			     service_t *svc);
+
+/*
+	Add an event from the supervision history to a writer that was set
+	up with version INIT_HISTORY_VERSION.
+*/
+int init_history_writer_add(status_writer_t *w, const history_entry_t *ent);
+
+/* send the remaining services and the end-of-list marker */
+int init_status_writer_finish(status_writer_t *w);
+
+/********** ctlclient.c **********/
+
+/*
+	Accept a connection on the SOCK_SEQPACKET socket and register it with
+	the event loop, passing the new client to the handler as argument.
+*/
+ctlclient_t *ctlclient_accept(int listenfd, evloop_handler_t handler);
+
+/*
+	Get a client for replying to a datagram received on fd from addr.
+	The same client is returned for the same peer while it is in use or
+	has replies queued. Every call must be paired with a call to
+	ctlclient_release.
+*/
+ctlclient_t *ctlclient_datagram(int fd, const struct sockaddr_un *addr,
+				socklen_t addrlen);
+
+/*
+	Drop a reference to a datagram client. It is freed once it is no
+	longer used and has no replies queued.
+*/
+void ctlclient_release(ctlclient_t *cl);
+
+/* Close a connection or drop a datagram client. */
+void ctlclient_close(ctlclient_t *cl);
+
+/*
+	Send a message to a client, or queue it if the client cannot take it
+	right now. Returns 0 on success, -1 if the client is dead.
+*/
+int ctlclient_send(ctlclient_t *cl, const void *data, size_t size);
+
+/* Send as much of the queue as possible. Returns -1 if the client died. */
+int ctlclient_flush(ctlclient_t *cl);
+
+/* Close all connections that were marked dead. */
+void ctlclient_reap(void);
+
+/* Event loop timeout in milliseconds for retrying queued datagrams. */
+int ctlclient_poll_timeout(void);
+
+/* Retry queued datagrams and drop datagram clients that are stuck. */
+void ctlclient_flush_datagrams(void);
+
+/********** svcsock.c **********/
+
+/*
+	Create the listening sockets of a service, if it has any and they
+	are not open yet. On failure, none of them are left open.
+*/
+int svcsock_open(service_t *svc);
+
+/* Close the listening sockets of a service and remove unix sockets. */
+void svcsock_close(service_t *svc);
+
+/*
+	Move the listening sockets from a service to its reloaded version if
+	it declares the same ones, otherwise replace them.
+*/
+void svcsock_take_over(service_t *svc, service_t *old);
+
+/*
+	Wait for a client on the sockets of a lazy service in the event loop
+	and tell the supervisor about the first one.
+*/
+int svcsock_watch(service_t *svc);
+
+void svcsock_unwatch(service_t *svc);
+
+/********** svcready.c **********/
+
+/*
+	Prepare waiting for a service to become ready, before its first
+	command is started: create the notification pipe or watch for the
+	ready file to appear, removing a stale one. The service is reported
+	through supervisor_service_ready once it is ready.
+*/
+int svcready_start(service_t *svc);
+
+/* Stop waiting for readiness and close the notification pipe. */
+void svcready_stop(service_t *svc);
+
+/********** svccgroup.c **********/
+
+/*
+	Create the cgroup v2 group of a service below the cgroup of init,
+	if it does not have one yet, and report through
+	supervisor_service_gone whenever it becomes empty. Fails if no
+	cgroup v2 hierarchy is mounted (yet), in which case the service is
+	run in the cgroup of init.
+*/
+int svccgroup_create(service_t *svc);
+
+/* Stop watching the cgroup of a service and remove it if it is empty. */
+void svccgroup_destroy(service_t *svc);
+
+/* Check whether there are processes left in the cgroup of a service. */
+bool svccgroup_populated(service_t *svc);
+
+/* Kill all processes in the cgroup of a service through cgroup.kill. */
+int svccgroup_kill(service_t *svc);
+
+/********** svchistory.c **********/
+
+/*
+	Record a supervision event (EHE_*) of a service in the history ring
+	buffer, overwriting the oldest one if it is full.
+*/
+void svchistory_add(const service_t *svc, int event, unsigned int index,
+		    int value);
+
+/* Send the recorded history to a client, oldest event first. */
+void svchistory_send(ctlclient_t *cl);
+
+/********** svcevent.c **********/
+
+/* Set the socket that state change events are sent from. */
+void svcevent_set_socket(int fd);
+
+/*
+	Register a client that receives an init_response_event_t for every
+	service state change. Connections are remembered by their socket,
+	datagram clients by their address. Returns 0 on success, -1 if there
+	are too many subscribers.
+*/
+int svcevent_subscribe(ctlclient_t *cl);
+
+void svcevent_unsubscribe(const ctlclient_t *cl);
+
+/*
+	Send a state change event to all subscribers. Subscribers that
+	cannot receive the event immediately are dropped.
+*/
+void svcevent_notify(const service_t *svc, int old_state, int new_state);
 
 #endif /* INIT_H */
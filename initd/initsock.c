@@ -1,23 +1,9 @@
 /* SPDX-License-Identifier: ISC */
-#include "init.h"
-
-static int send_retry(int fd, const void *dst, size_t addrlen,
-		      const void *buffer, size_t size)
-{
-	ssize_t ret;
-retry:
-	ret = sendto(fd, buffer, size, MSG_NOSIGNAL, dst, addrlen);
-	if (ret < 0 && errno == EINTR)
-		goto retry;
+#include <stddef.h>
 
-	if (ret < 0 || (size_t)ret < size)
-		return -1;
-
-	return 0;
-}
+#include "init.h"
 
-static int send_string(int fd, const void *dst, size_t addrlen,
-		       const char *str)
+static int send_string(ctlclient_t *cl, const char *str)
 {
 	size_t len = strlen(str);
 	uint16_t raw;
@@ -26,10 +12,10 @@ static int send_string(int fd, const void *dst, size_t addrlen,
 		return -1;
 
 	raw = htobe16(len);
-	if (send_retry(fd, dst, addrlen, &raw, 2))
+	if (ctlclient_send(cl, &raw, 2))
 		return -1;
 
-	return len > 0 ? send_retry(fd, dst, addrlen, str, len) : 0;
+	return len > 0 ? ctlclient_send(cl, str, len) : 0;
 }
 
 int init_socket_create(void)
@@ -59,8 +45,57 @@ int init_socket_create(void)
 	return fd;
 }
 
-int init_socket_send_status(int fd, const void *dest_addr, size_t addrlen,
-			    E_SERVICE_STATE state, service_t *svc)
+int init_socket_create_listener(void)
+{
+	struct sockaddr_un un;
+	socklen_t len;
+	int fd;
+
+	fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if (fd < 0) {
+		perror("socket");
+		return -1;
+	}
+
+	memset(&un, 0, sizeof(un));
+	un.sun_family = AF_UNIX;
+	memcpy(un.sun_path + 1, INIT_SOCK_ABSTRACT,
+	       sizeof(INIT_SOCK_ABSTRACT) - 1);
+
+	len = offsetof(struct sockaddr_un, sun_path) +
+	      sizeof(INIT_SOCK_ABSTRACT);
+
+	if (bind(fd, (struct sockaddr *)&un, len)) {
+		perror("bind: @" INIT_SOCK_ABSTRACT);
+		close(fd);
+		return -1;
+	}
+
+	if (listen(fd, INIT_MAX_CLIENTS)) {
+		perror("listen: @" INIT_SOCK_ABSTRACT);
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static E_SERVICE_STATE compat_state(E_SERVICE_STATE state, int version)
+{
+	switch (state) {
+	case ESS_BACKOFF:
+		return version >= 2 ? state : ESS_ENQUEUED;
+	case ESS_READY:
+		return version >= 3 ? state : ESS_RUNNING;
+	case ESS_IDLE:
+		return version >= 3 ? state : ESS_ENQUEUED;
+	default:
+		return state;
+	}
+}
+
+int init_socket_send_status(ctlclient_t *cl, E_SERVICE_STATE state,
+			    service_t *svc)
 {
 	init_response_status_t info;
 
@@ -70,19 +105,206 @@ int init_socket_send_status(int fd, const void *dest_addr, size_t addrlen,
 		info.state = ESS_NONE;
 		info.id = -1;
 	} else {
-		info.state = state;
+		info.state = compat_state(state, 0);
 		info.exit_status = svc->status & 0xFF;
 		info.id = htobe32(svc->id);
 	}
 
-	if (send_retry(fd, dest_addr, addrlen, &info, sizeof(info)))
+	if (ctlclient_send(cl, &info, sizeof(info)))
 		return -1;
 
 	if (svc != NULL && state != ESS_NONE) {
-		if (send_string(fd, dest_addr, addrlen, svc->fname))
+		if (send_string(cl, svc->fname))
 			return -1;
-		if (send_string(fd, dest_addr, addrlen, svc->name))
+		if (send_string(cl, svc->name))
 			return -1;
 	}
 	return 0;
 }
+
+int init_socket_send_match(ctlclient_t *cl, int count)
+{
+	init_response_match_t resp;
+
+	memset(&resp, 0, sizeof(resp));
+	resp.count = htobe32(count);
+
+	return ctlclient_send(cl, &resp, sizeof(resp));
+}
+
+E_SERVICE_STATE init_status_writer_state(const status_writer_t *w,
+					 E_SERVICE_STATE state)
+{
+	return compat_state(state, w->version);
+}
+
+void init_status_writer_init(status_writer_t *w, ctlclient_t *cl, int version)
+{
+	w->cl = cl;
+	w->version = version;
+	w->size = sizeof(init_status_batch_t);
+	w->count = 0;
+}
+
+static int flush_batch(status_writer_t *w, bool last)
+{
+	init_status_batch_t hdr;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.version = w->version;
+	hdr.flags = last ? ISB_FLAG_LAST : 0;
+	hdr.count = htobe16(w->count);
+	memcpy(w->buffer, &hdr, sizeof(hdr));
+
+	if (ctlclient_send(w->cl, w->buffer, w->size))
+		return -1;
+
+	w->size = sizeof(hdr);
+	w->count = 0;
+	return 0;
+}
+
+/* make room for a record of the given size, flushing the batch if full */
+static uint8_t *reserve_record(status_writer_t *w, size_t total)
+{
+	uint8_t *ptr;
+
+	if (w->size + total > sizeof(w->buffer) || w->count == 0xFFFF) {
+		if (flush_batch(w, false))
+			return NULL;
+	}
+
+	ptr = w->buffer + w->size;
+	memset(ptr, 0, total);
+
+	w->size += total;
+	w->count += 1;
+	return ptr;
+}
+
+/*
+	Append a record followed by the file name and name of a service to
+	the batch. Services with names that cannot be encoded are skipped.
+*/
+static int add_record(status_writer_t *w, const void *rec, size_t size,
+		      const service_t *svc)
+{
+	size_t flen = strlen(svc->fname), nlen = strlen(svc->name), total;
+	uint8_t *ptr;
+
+	total = (size + flen + nlen + 2 + 3) & ~((size_t)3);
+	if (flen > 0xFFFF || nlen > 0xFFFF ||
+	    total > sizeof(w->buffer) - sizeof(init_status_batch_t)) {
+		return 0;
+	}
+
+	ptr = reserve_record(w, total);
+	if (ptr == NULL)
+		return -1;
+
+	memcpy(ptr, rec, size);
+	memcpy(ptr + size, svc->fname, flen);
+	memcpy(ptr + size + flen + 1, svc->name, nlen);
+	return 0;
+}
+
+static void encode_usage(uint64_t *out, const svc_usage_t *usage)
+{
+	out[0] = htobe64(usage->utime);
+	out[1] = htobe64(usage->stime);
+	out[2] = htobe64(usage->maxrss);
+	out[3] = htobe64(usage->minflt);
+	out[4] = htobe64(usage->majflt);
+}
+
+int init_status_writer_add(status_writer_t *w, E_SERVICE_STATE state,
+			   service_t *svc)
+{
+	size_t flen = strlen(svc->fname), nlen = strlen(svc->name);
+	init_status_record_t rec;
+
+	if (w->version == 0) {
+		return init_socket_send_status(w->cl, state, svc);
+	}
+
+	memset(&rec, 0, sizeof(rec));
+	rec.state = compat_state(state, w->version);
+	rec.exit_status = svc->status & 0xFF;
+	rec.fname_len = htobe16(flen);
+	rec.id = htobe32(svc->id);
+	rec.name_len = htobe16(nlen);
+
+	if (w->version < 2)
+		return add_record(w, &rec, INIT_STATUS_RECORD_V1, svc);
+
+	rec.respawns = htobe16(svc->rspwn_count > 0xFFFF ?
+			       0xFFFF : svc->rspwn_count);
+
+	if (state == ESS_BACKOFF)
+		rec.backoff = htobe32(supervisor_respawn_delay(svc));
+
+	if (w->version < 3)
+		return add_record(w, &rec, INIT_STATUS_RECORD_V2, svc);
+
+	rec.signal = svc->term_signal;
+	if (svc->flags & SVC_FLAG_CORE_DUMPED)
+		rec.flags |= ISR_FLAG_CORE_DUMPED;
+	rec.run_time = htobe64(svc->run_time);
+
+	encode_usage(rec.usage, &svc->usage);
+	encode_usage(rec.total_usage, &svc->total_usage);
+
+	return add_record(w, &rec, sizeof(rec), svc);
+}
+
+int init_timeline_writer_add(status_writer_t *w, E_SERVICE_STATE state,
+			     service_t *svc)
+{
+	size_t flen = strlen(svc->fname), nlen = strlen(svc->name);
+	init_timeline_record_t rec;
+	int i;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.state = state;
+	rec.type = svc->type;
+	rec.target = svc->target;
+	rec.id = htobe32(svc->id);
+	rec.fname_len = htobe16(flen);
+	rec.name_len = htobe16(nlen);
+
+	for (i = 0; i < SVC_TS_MAX; ++i) {
+		rec.mono[i] = htobe64(svc->ts_mono[i]);
+		rec.boot[i] = htobe64(svc->ts_boot[i]);
+	}
+
+	return add_record(w, &rec, sizeof(rec), svc);
+}
+
+int init_history_writer_add(status_writer_t *w, const history_entry_t *ent)
+{
+	init_history_record_t rec;
+	uint8_t *ptr;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.timestamp = htobe64(ent->timestamp);
+	rec.id = htobe32(ent->id);
+	rec.event = ent->event;
+	rec.index = htobe16(ent->index);
+	rec.value = htobe32(ent->value);
+
+	ptr = reserve_record(w, sizeof(rec));
+	if (ptr == NULL)
+		return -1;
+
+	memcpy(ptr, &rec, sizeof(rec));
+	return 0;
+}
+
+int init_status_writer_finish(status_writer_t *w)
+{
+	if (w->version == 0) {
+		return init_socket_send_status(w->cl, ESS_NONE, NULL);
+	}
+
+	return flush_batch(w, true);
+}
@@ -3,79 +3,259 @@
 
 static int sigfd = -1;
 static int sockfd = -1;
+static int watchfd = -1;
+static int listenfd = -1;
+static bool orphans_pending = false;
 
-static void handle_signal(void)
+#define SIGINFO_BATCH 16
+
+static void handle_request(int fd, uint32_t events, void *arg);
+
+/*
+	Service processes are collected through their pidfds. Everything
+	else that exits, i.e. orphans re-parented to us, is reaped here
+	after the other events have been handled. Children are only peeked
+	at first, so we never steal one whose pidfd event is still pending.
+*/
+static void reap_orphans(void)
 {
-	struct signalfd_siginfo info;
-	int status;
+	siginfo_t info;
 	pid_t pid;
 
-	if (read(sigfd, &info, sizeof(info)) != sizeof(info)) {
-		perror("read on signal fd");
-		return;
+	for (;;) {
+		memset(&info, 0, sizeof(info));
+
+		if (waitid(P_ALL, 0, &info, WEXITED | WNOHANG | WNOWAIT) != 0)
+			break;
+
+		pid = info.si_pid;
+		if (pid == 0)
+			break;
+
+		if (!supervisor_handle_exited(pid))
+			waitid(P_PID, pid, &info, WEXITED | WNOHANG);
+	}
+}
+
+static void recreate_socket(void)
+{
+	if (sockfd >= 0) {
+		evloop_remove(sockfd);
+		close(sockfd);
+		unlink(INIT_SOCK_PATH);
+		sockfd = -1;
 	}
 
-	switch (info.ssi_signo) {
-	case SIGCHLD:
-		while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
-			status = WIFEXITED(status) ? WEXITSTATUS(status) :
-						     EXIT_FAILURE;
+	sockfd = init_socket_create();
+	svcevent_set_socket(sockfd);
+
+	if (sockfd >= 0)
+		evloop_add(sockfd, EPOLLIN, handle_request, NULL);
+}
+
+static void handle_signal(int fd, uint32_t events, void *arg)
+{
+	struct signalfd_siginfo info[SIGINFO_BATCH];
+	ssize_t ret;
+	size_t i;
+	(void)events;
+	(void)arg;
+retry:
+	ret = read(fd, info, sizeof(info));
+
+	if (ret < 0 && errno == EINTR)
+		goto retry;
+
+	if (ret < (ssize_t)sizeof(info[0])) {
+		if (ret != 0 && errno != EAGAIN)
+			perror("read on signal fd");
+		return;
+	}
 
-			supervisor_handle_exited(pid, status);
+	for (i = 0; i < (size_t)ret / sizeof(info[0]); ++i) {
+		switch (info[i].ssi_signo) {
+		case SIGCHLD:
+			orphans_pending = true;
+			break;
+		case SIGTERM:
+			supervisor_set_target(TGT_SHUTDOWN);
+			break;
+		case SIGINT:
+			supervisor_set_target(TGT_REBOOT);
+			break;
+		case SIGHUP:
+			runsvc_reload_env();
+			supervisor_reload_config();
+			break;
+		case SIGUSR1:
+			recreate_socket();
+			break;
 		}
+	}
+}
+
+static void handle_watch(int fd, uint32_t events, void *arg)
+{
+	(void)events;
+	(void)arg;
+	svcwatch_handle(fd);
+}
+
+/* check that the patterns appended to a match request are well formed */
+static bool check_patterns(const char *ptr, size_t size, int count)
+{
+	if (size == 0 || ptr[size - 1] != '\0')
+		return count == 0;
+
+	while (size > 0) {
+		--size;
+		if (ptr[size] == '\0')
+			--count;
+	}
+
+	return count == 0;
+}
+
+typedef union {
+	init_request_t rq;
+	uint8_t raw[INIT_REQUEST_MAX];
+} request_buffer_t;
+
+/*
+	Process a single request. Replies are queued on the client and sent
+	without blocking the main loop.
+*/
+static void dispatch_request(ctlclient_t *cl, request_buffer_t *buffer,
+			     size_t size)
+{
+	init_request_t *rq = &buffer->rq;
+	const char *patterns;
+	int count, version;
+	size_t plen;
+
+	switch (rq->rq) {
+	case EIR_STATUS:
+		supervisor_answer_status_request(cl, rq->arg.status.filter, 0);
 		break;
-	case SIGTERM:
-		supervisor_set_target(TGT_SHUTDOWN);
+	case EIR_STATUS_BATCH:
+		/* reply in the newest format both sides understand */
+		version = rq->arg.status.version;
+		if (version == 0)
+			version = 1;
+		if (version > INIT_STATUS_VERSION)
+			version = INIT_STATUS_VERSION;
+
+		supervisor_answer_status_request(cl, rq->arg.status.filter,
+						 version);
 		break;
-	case SIGINT:
-		supervisor_set_target(TGT_REBOOT);
+	case EIR_START:
+		rq->arg.startstop.id = be32toh(rq->arg.startstop.id);
+		supervisor_start(rq->arg.startstop.id);
 		break;
-	case SIGHUP:
-		supervisor_reload_config();
+	case EIR_STOP:
+		rq->arg.startstop.id = be32toh(rq->arg.startstop.id);
+		supervisor_stop(rq->arg.startstop.id);
 		break;
-	case SIGUSR1:
-		if (sockfd >= 0) {
-			close(sockfd);
-			unlink(INIT_SOCK_PATH);
-			sockfd = -1;
+	case EIR_START_MATCH:
+	case EIR_STOP_MATCH:
+		count = be16toh(rq->arg.match.count);
+		plen = be16toh(rq->arg.match.size);
+		patterns = (const char *)buffer->raw + sizeof(*rq);
+
+		if (plen != size - sizeof(*rq) ||
+		    !check_patterns(patterns, plen, count)) {
+			count = 0;
+		} else {
+			count = supervisor_startstop_match(rq->rq, patterns,
+							   count);
 		}
-		sockfd = init_socket_create();
+
+		init_socket_send_match(cl, count);
+		break;
+	case EIR_SUBSCRIBE:
+		svcevent_subscribe(cl);
+		break;
+	case EIR_UNSUBSCRIBE:
+		svcevent_unsubscribe(cl);
+		break;
+	case EIR_TIMELINE:
+		supervisor_answer_timeline_request(cl);
+		break;
+	case EIR_HISTORY:
+		svchistory_send(cl);
 		break;
 	}
 }
 
-static void handle_request(void)
+static void handle_request(int fd, uint32_t events, void *arg)
 {
+	request_buffer_t buffer;
 	struct sockaddr_un addr;
-	init_request_t rq;
 	socklen_t addrlen;
+	ctlclient_t *cl;
 	ssize_t ret;
+	(void)events;
+	(void)arg;
 retry:
-	memset(&rq, 0, sizeof(rq));
+	memset(&buffer.rq, 0, sizeof(buffer.rq));
 	addrlen = sizeof(addr);
-	ret = recvfrom(sockfd, &rq, sizeof(rq), MSG_DONTWAIT | MSG_TRUNC,
+	ret = recvfrom(fd, &buffer, sizeof(buffer),
+		       MSG_DONTWAIT | MSG_TRUNC,
 		       (struct sockaddr *)&addr, &addrlen);
 
 	if (ret < 0 && errno == EINTR)
 		goto retry;
 
-	if ((size_t)ret < sizeof(rq))
+	if (ret < 0 || (size_t)ret < sizeof(buffer.rq) ||
+	    (size_t)ret > sizeof(buffer)) {
 		return;
+	}
 
-	switch (rq.rq) {
-	case EIR_STATUS:
-		supervisor_answer_status_request(sockfd, &addr, addrlen,
-						 rq.arg.status.filter);
-		break;
-	case EIR_START:
-		rq.arg.startstop.id = be32toh(rq.arg.startstop.id);
-		supervisor_start(rq.arg.startstop.id);
-		break;
-	case EIR_STOP:
-		rq.arg.startstop.id = be32toh(rq.arg.startstop.id);
-		supervisor_stop(rq.arg.startstop.id);
-		break;
+	cl = ctlclient_datagram(fd, &addr, addrlen);
+	if (cl == NULL)
+		return;
+
+	dispatch_request(cl, &buffer, ret);
+	ctlclient_release(cl);
+}
+
+static void handle_client(int fd, uint32_t events, void *arg)
+{
+	ctlclient_t *cl = arg;
+	request_buffer_t buffer;
+	ssize_t ret;
+
+	if (events & EPOLLOUT)
+		ctlclient_flush(cl);
+
+	if (!(events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+		return;
+retry:
+	memset(&buffer.rq, 0, sizeof(buffer.rq));
+	ret = recv(fd, &buffer, sizeof(buffer), MSG_DONTWAIT | MSG_TRUNC);
+
+	if (ret < 0 && errno == EINTR)
+		goto retry;
+
+	if (ret < 0 && errno == EAGAIN)
+		return;
+
+	if (ret <= 0) {
+		cl->dead = true;
+		return;
 	}
+
+	if ((size_t)ret < sizeof(buffer.rq) || (size_t)ret > sizeof(buffer))
+		return;
+
+	dispatch_request(cl, &buffer, ret);
+}
+
+static void handle_listen(int fd, uint32_t events, void *arg)
+{
+	(void)events;
+	(void)arg;
+	ctlclient_accept(fd, handle_client);
 }
 
 void target_completed(int target)
@@ -83,7 +263,7 @@ void target_completed(int target)
 	switch (target) {
 	case TGT_BOOT:
 		if (sockfd < 0)
-			sockfd = init_socket_create();
+			recreate_socket();
 		break;
 	case TGT_SHUTDOWN:
 		for (;;)
@@ -107,7 +287,7 @@ static int sigsetup(void)
 		return -1;
 	}
 
-	sfd = signalfd(-1, &mask, SFD_CLOEXEC);
+	sfd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
 	if (sfd == -1) {
 		perror("signalfd");
 		return -1;
@@ -119,51 +299,62 @@ static int sigsetup(void)
 	return sfd;
 }
 
-int main(void)
+int main(int argc, char **argv)
 {
-	int i, ret, count;
-	struct pollfd pfd[2];
+	bool serial = false;
+	int i;
 
 	if (getpid() != 1) {
 		fputs("init does not have pid 1, terminating!\n", stderr);
 		return EXIT_FAILURE;
 	}
 
-	supervisor_init();
+	for (i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "serialboot") == 0)
+			serial = true;
+		if (strcmp(argv[i], "forkspawn") == 0)
+			runsvc_set_backend(SPAWN_FORK);
+	}
+
+	if (evloop_init())
+		return -1;
+
+	/*
+		The abstract socket needs no file system, so it is taken before
+		any service runs and could claim the name for itself.
+	*/
+	listenfd = init_socket_create_listener();
+	if (listenfd >= 0)
+		evloop_add(listenfd, EPOLLIN, handle_listen, NULL);
+
+	runsvc_reload_env();
+	supervisor_init(serial);
+	watchfd = svcwatch_init();
 
 	sigfd = sigsetup();
 	if (sigfd < 0)
 		return -1;
 
+	if (evloop_add(sigfd, EPOLLIN, handle_signal, NULL))
+		return -1;
+
+	if (watchfd >= 0)
+		evloop_add(watchfd, EPOLLIN, handle_watch, NULL);
+
 	for (;;) {
 		while (supervisor_process_queues())
 			;
 
-		memset(pfd, 0, sizeof(pfd));
-		count = 0;
+		ctlclient_reap();
 
-		pfd[count].fd = sigfd;
-		pfd[count].events = POLLIN;
-		++count;
+		evloop_dispatch(ctlclient_poll_timeout());
 
-		if (sockfd >= 0) {
-			pfd[count].fd = sockfd;
-			pfd[count].events = POLLIN;
-			++count;
+		if (orphans_pending) {
+			orphans_pending = false;
+			reap_orphans();
 		}
 
-		ret = poll(pfd, count, -1);
-		if (ret <= 0)
-			continue;
-
-		for (i = 0; i < count; ++i) {
-			if (pfd[i].revents & POLLIN) {
-				if (pfd[i].fd == sigfd)
-					handle_signal();
-				if (pfd[i].fd == sockfd)
-					handle_request();
-			}
-		}
+		ctlclient_flush_datagrams();
 	}
 
 	return EXIT_SUCCESS;
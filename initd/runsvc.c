@@ -1,61 +1,73 @@
 /* SPDX-License-Identifier: ISC */
+#include <sys/resource.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
-#include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <limits.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <dirent.h>
+#include <sched.h>
 #include <stdio.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <ctype.h>
 
+#include <linux/sched.h>
+
 #include "init.h"
 
-static int setup_env(void)
+#define SPAWN_STACK_SIZE (64 * 1024)
+#define DEFAULT_PATH "/bin:/usr/bin"
+
+#ifndef CLONE_PIDFD
+#define CLONE_PIDFD 0x00001000
+#endif
+
+typedef struct {
+	service_t *svc;
+	exec_t *exec;
+	char **envp;
+	int max_fd;
+	int cgroup_procs;	/* cgroup.procs file the child joins or -1 */
+	int num_fds;
+	int fds[SVC_MAX_SOCKETS + 1];
+	char listen_fds[32];
+	char listen_pid[32];
+	char notify_fd[32];
+} spawn_args_t;
+
+static int backend = SPAWN_VFORK;
+static void *spawn_stack = NULL;
+static char **environment = NULL;
+static char **spawn_env = NULL;		/* environment plus passed fds */
+static size_t env_count = 0;
+static unsigned int env_gen = 0;
+
+static int close_fds_from(int first, int max_fd)
 {
-	int status = -1;
-	ssize_t ret;
-	FILE *fp;
-
-	clearenv();
-
-	fp = fopen(ENVFILE, "r");
-	if (fp == NULL) {
-		perror(ENVFILE);
-		return -1;
-	}
-
-	do {
-		char *line = NULL;
-		size_t n = 0;
-
-		errno = 0;
-		ret = getline(&line, &n, fp);
-
-		if (ret < 0) {
-			if (errno == 0) {
-				status = 0;
-			} else {
-				perror(ENVFILE);
-			}
-		} else if (ret > 0 && putenv(line) != 0) {
-			perror("putenv");
-			ret = -1;
-		}
-
-		free(line);
-	} while (ret >= 0);
+#ifdef HAVE_CLOSE_RANGE
+	if (close_range(first, ~0U, 0) == 0)
+		return 0;
+#endif
+	for (; first < max_fd; ++first)
+		close(first);
 
-	fclose(fp);
-	return status;
+	return 0;
 }
 
-static int close_all_files(void)
+static int close_all_files(int first)
 {
 	struct dirent *ent;
 	DIR *dir;
 	int fd;
 
+#ifdef HAVE_CLOSE_RANGE
+	if (close_range(first, ~0U, 0) == 0)
+		return 0;
+#endif
 	dir = opendir(PROCFDDIR);
 	if (dir == NULL) {
 		perror(PROCFDDIR);
@@ -67,15 +79,102 @@ static int close_all_files(void)
 			continue;
 
 		fd = atoi(ent->d_name);
-		close(fd);
+		if (fd >= first)
+			close(fd);
 	}
 
 	closedir(dir);
 	return 0;
 }
 
-static int setup_tty(const char *tty, bool truncate)
+static void format_pid(char *dst, pid_t pid)
+{
+	char buffer[16];
+	int i = 0;
+
+	do {
+		buffer[i++] = '0' + pid % 10;
+		pid /= 10;
+	} while (pid > 0);
+
+	while (i > 0)
+		*(dst++) = buffer[--i];
+
+	*dst = '\0';
+}
+
+/*
+	Move the file descriptors passed to a service in place, starting at
+	LISTEN_FDS_START, and close standard I/O. Returns the first file
+	descriptor that still needs to be closed.
+*/
+static int setup_passed_fds(spawn_args_t *args)
+{
+	int i, fd;
+
+	if (args->num_fds == 0)
+		return 0;
+
+	/* move them out of the way first, so dup2 cannot clobber one */
+	for (i = 0; i < args->num_fds; ++i) {
+		fd = fcntl(args->fds[i], F_DUPFD_CLOEXEC,
+			   LISTEN_FDS_START + args->num_fds);
+		if (fd < 0)
+			return -1;
+		args->fds[i] = fd;
+	}
+
+	for (i = 0; i < args->num_fds; ++i) {
+		if (dup2(args->fds[i], LISTEN_FDS_START + i) < 0)
+			return -1;
+	}
+
+	if (args->listen_pid[0] != '\0')
+		format_pid(args->listen_pid + strlen("LISTEN_PID="), getpid());
+
+	close(STDIN_FILENO);
+	close(STDOUT_FILENO);
+	close(STDERR_FILENO);
+	return LISTEN_FDS_START + args->num_fds;
+}
+
+/*
+	Report an error from a child process. The child of the vfork backend
+	shares its memory with init, so this must not touch stdio buffers or
+	the locale data that perror uses.
+*/
+static void child_error(const char *what, int err)
 {
+#ifdef HAVE_STRERRORDESC_NP
+	const char *msg = strerrordesc_np(err);
+#else
+	const char *msg = strerror(err);
+#endif
+	struct iovec iov[4];
+
+	if (msg == NULL)
+		msg = "unknown error";
+
+	iov[0].iov_base = (void *)what;
+	iov[0].iov_len = strlen(what);
+	iov[1].iov_base = (void *)": ";
+	iov[1].iov_len = 2;
+	iov[2].iov_base = (void *)msg;
+	iov[2].iov_len = strlen(msg);
+	iov[3].iov_base = (void *)"\n";
+	iov[3].iov_len = 1;
+
+	writev(STDERR_FILENO, iov, 4);
+}
+
+/*
+	Redirect standard I/O to the tty of a service. The output file is
+	truncated before the first command of a service, if requested, and
+	appended to by all subsequent commands.
+*/
+static int setup_tty(const service_t *svc, const exec_t *e)
+{
+	const char *tty = svc->ctty;
 	int fd;
 
 	if (tty == NULL)
@@ -83,75 +182,569 @@ static int setup_tty(const char *tty, bool truncate)
 
 	fd = open(tty, O_RDWR);
 	if (fd < 0) {
-		perror(tty);
+		child_error(tty, errno);
 		return -1;
 	}
 
-	if (truncate)
+	if (e != svc->exec) {
+		lseek(fd, 0, SEEK_END);
+	} else if (svc->flags & SVC_FLAG_TRUNCATE_OUT) {
 		ftruncate(fd, 0);
+	}
 
 	setsid();
 
 	dup2(fd, STDIN_FILENO);
 	dup2(fd, STDOUT_FILENO);
 	dup2(fd, STDERR_FILENO);
-	close(fd);
+	if (fd > STDERR_FILENO)
+		close(fd);
 	return 0;
 }
 
-static __attribute__((noreturn)) void argv_exec(exec_t *e)
+/* the PATH from an environment vector, or the default one */
+static const char *search_path(char *const envp[])
 {
-	char **argv = alloca(sizeof(char *) * (e->argc + 1)), *ptr;
 	int i;
 
-	for (ptr = e->args, i = 0; i < e->argc; ++i, ptr += strlen(ptr) + 1)
-		argv[i] = ptr;
+	for (i = 0; envp[i] != NULL; ++i) {
+		if (strncmp(envp[i], "PATH=", 5) == 0)
+			return envp[i] + 5;
+	}
+
+	return DEFAULT_PATH;
+}
+
+/*
+	Equivalent of execvp, but searches the PATH set in envp instead of
+	the one from our own environment. Only touches the stack, so it can
+	be used in a child sharing our address space.
+*/
+static void exec_path(char *const argv[], char *const envp[])
+{
+	const char *path = search_path(envp), *end;
+	char buffer[PATH_MAX];
+	size_t dlen, flen;
+	int err = ENOENT;
+
+	if (strchr(argv[0], '/') != NULL) {
+		execve(argv[0], argv, envp);
+		return;
+	}
+
+	flen = strlen(argv[0]);
+
+	for (; *path != '\0'; path = (*end == ':') ? end + 1 : end) {
+		end = strchrnul(path, ':');
+		dlen = end - path;
+
+		if (dlen + flen + 2 > sizeof(buffer))
+			continue;
+
+		memcpy(buffer, path, dlen);
+		if (dlen > 0)
+			buffer[dlen++] = '/';
+		memcpy(buffer + dlen, argv[0], flen + 1);
+
+		execve(buffer, argv, envp);
+
+		if (errno == EACCES)
+			err = EACCES;
+		else if (errno != ENOENT && errno != ENOTDIR)
+			return;
+	}
 
-	argv[i] = NULL;
-	execvp(argv[0], argv);
-	perror(argv[0]);
+	errno = err;
+}
+
+/*
+	Look up a command in the PATH of the service environment and return
+	an allocated copy of the absolute path of the executable, or NULL if
+	it has none or cannot be found.
+*/
+static char *resolve_path(const char *cmd)
+{
+	const char *path = search_path(environment), *end;
+	char buffer[PATH_MAX];
+	size_t dlen, flen;
+	struct stat sb;
+
+	if (strchr(cmd, '/') != NULL)
+		return NULL;
+
+	flen = strlen(cmd);
+
+	for (; *path != '\0'; path = (*end == ':') ? end + 1 : end) {
+		end = strchrnul(path, ':');
+		dlen = end - path;
+
+		if (dlen == 0 || path[0] != '/' ||
+		    dlen + flen + 2 > sizeof(buffer)) {
+			continue;
+		}
+
+		memcpy(buffer, path, dlen);
+		buffer[dlen++] = '/';
+		memcpy(buffer + dlen, cmd, flen + 1);
+
+		if (stat(buffer, &sb) == 0 && S_ISREG(sb.st_mode) &&
+		    access(buffer, X_OK) == 0) {
+			return strdup(buffer);
+		}
+	}
+
+	return NULL;
+}
+
+/*
+	Build the argument vector of a command and resolve the executable,
+	once per loaded service and environment, so that spawning it needs
+	neither allocations nor a PATH search.
+*/
+static int prepare_exec(exec_t *e)
+{
+	char *ptr;
+	int i;
+
+	if (e->argv == NULL) {
+		e->argv = calloc(e->argc + 1, sizeof(e->argv[0]));
+		if (e->argv == NULL) {
+			perror("runsvc");
+			return -1;
+		}
+
+		for (ptr = e->args, i = 0; i < e->argc;
+		     ++i, ptr += strlen(ptr) + 1) {
+			e->argv[i] = ptr;
+		}
+	}
+
+	if (e->path_gen != env_gen) {
+		free(e->path);
+		e->path = resolve_path(e->argv[0]);
+		e->path_gen = env_gen;
+
+		if (e->path == NULL && strchr(e->argv[0], '/') == NULL)
+			fprintf(stderr, "%s: command not found\n", e->argv[0]);
+	}
+
+	return 0;
+}
+
+/*
+	Execute a prepared command. If the resolved executable went away in
+	the mean time, fall back to searching the PATH again.
+*/
+static void exec_command(exec_t *e, char *const envp[])
+{
+	if (e->path != NULL) {
+		execve(e->path, e->argv, envp);
+
+		if (errno != ENOENT && errno != ENOTDIR)
+			return;
+	}
+
+	exec_path(e->argv, envp);
+}
+
+static __attribute__((noreturn)) void argv_exec(exec_t *e, char *const envp[])
+{
+	exec_command(e, envp);
+	perror(e->argv[0]);
 	exit(EXIT_FAILURE);
 }
 
-static int run_sequentially(exec_t *list)
+/*
+	Read the environment file into a single, packed block holding a NULL
+	terminated array of "name=value" strings followed by the strings
+	themselves, so it can be passed to execve as is and released with a
+	single call to free.
+*/
+static char **load_env(void)
 {
-	pid_t ret, pid;
-	int status;
+	char *data = NULL, *ptr, *end, **envp;
+	size_t i, size, count = 0;
+	struct stat sb;
+	ssize_t ret;
+	int fd;
 
-	for (; list != NULL; list = list->next) {
-		if (list->next == NULL)
-			argv_exec(list);
+	fd = open(ENVFILE, O_RDONLY | O_CLOEXEC);
+	if (fd < 0 || fstat(fd, &sb))
+		goto fail;
 
-		pid = fork();
+	size = sb.st_size;
+	data = malloc(size + 1);
+	if (data == NULL)
+		goto fail;
+
+	for (i = 0; i < size; i += ret) {
+		ret = read(fd, data + i, size - i);
+		if (ret < 0 && errno == EINTR) {
+			ret = 0;
+			continue;
+		}
+		if (ret < 0)
+			goto fail;
+		if (ret == 0)
+			break;
+	}
+
+	close(fd);
+	fd = -1;
+	size = i;
+	data[size] = '\0';
+
+	for (ptr = data; ptr < data + size; ptr = end + 1) {
+		end = strchrnul(ptr, '\n');
+		*end = '\0';
+
+		if (*ptr != '#' && strchr(ptr, '=') != NULL)
+			++count;
+	}
+
+	envp = malloc(sizeof(envp[0]) * (count + 1) + size + 1);
+	if (envp == NULL)
+		goto fail;
 
-		if (pid == 0)
-			argv_exec(list);
+	ptr = memcpy(envp + count + 1, data, size + 1);
+	end = ptr + size;
+	free(data);
 
-		if (pid == -1) {
-			perror("fork");
-			return EXIT_FAILURE;
+	for (i = 0; ptr < end; ptr += strlen(ptr) + 1) {
+		if (*ptr != '#' && strchr(ptr, '=') != NULL)
+			envp[i++] = ptr;
+	}
+
+	envp[i] = NULL;
+	return envp;
+fail:
+	perror(ENVFILE);
+	if (fd >= 0)
+		close(fd);
+	free(data);
+	return NULL;
+}
+
+/*
+	Move the child into the cgroup of the service, if it could not be
+	created there. This happens before the command is executed, so
+	everything the command forks ends up in the cgroup as well.
+*/
+static void join_cgroup(spawn_args_t *args)
+{
+	ssize_t ret;
+
+	if (args->cgroup_procs < 0)
+		return;
+
+	/* not fatal, it is then stopped the way it always was */
+	ret = write(args->cgroup_procs, "0", 1);
+	(void)ret;
+}
+
+static void open_cgroup_procs(spawn_args_t *args)
+{
+	if (args->svc->cgroup_fd >= 0) {
+		args->cgroup_procs = openat(args->svc->cgroup_fd,
+					    "cgroup.procs",
+					    O_WRONLY | O_CLOEXEC);
+	}
+}
+
+static void close_cgroup_procs(spawn_args_t *args)
+{
+	if (args->cgroup_procs >= 0) {
+		close(args->cgroup_procs);
+		args->cgroup_procs = -1;
+	}
+}
+
+static int spawn_child(void *arg)
+{
+	spawn_args_t *args = arg;
+	service_t *svc = args->svc;
+	sigset_t mask;
+	int first;
+
+	sigemptyset(&mask);
+	sigprocmask(SIG_SETMASK, &mask, NULL);
+
+	join_cgroup(args);
+
+	first = setup_passed_fds(args);
+	if (first < 0)
+		_exit(EXIT_FAILURE);
+
+	close_fds_from(first, args->max_fd);
+
+	if (setup_tty(svc, args->exec))
+		_exit(EXIT_FAILURE);
+
+	exec_command(args->exec, args->envp);
+	child_error(args->exec->argv[0], errno);
+	_exit(EXIT_FAILURE);
+}
+
+static int open_pidfd(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+	return syscall(SYS_pidfd_open, pid, 0);
+#else
+	(void)pid;
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+/*
+	Collect the file descriptors passed to a service and the matching
+	environment. The child fills in LISTEN_PID, once it knows its PID.
+*/
+static void prepare_spawn(spawn_args_t *args, service_t *svc, exec_t *e)
+{
+	size_t count = env_count;
+	int i;
+
+	memset(args, 0, sizeof(*args));
+	args->svc = svc;
+	args->exec = e;
+	args->envp = environment;
+	args->cgroup_procs = -1;
+
+	if (svc->listen_fds != NULL) {
+		for (i = 0; i < svc->num_sockets; ++i)
+			args->fds[args->num_fds++] = svc->listen_fds[i];
+
+		sprintf(args->listen_fds, "LISTEN_FDS=%d", svc->num_sockets);
+		strcpy(args->listen_pid, "LISTEN_PID=");
+		spawn_env[count++] = args->listen_fds;
+		spawn_env[count++] = args->listen_pid;
+	}
+
+	if (svc->notify_fd[1] >= 0) {
+		sprintf(args->notify_fd, "NOTIFY_FD=%d",
+			LISTEN_FDS_START + args->num_fds);
+		args->fds[args->num_fds++] = svc->notify_fd[1];
+		spawn_env[count++] = args->notify_fd;
+	}
+
+	if (count > env_count) {
+		spawn_env[count] = NULL;
+		args->envp = spawn_env;
+	}
+}
+
+/*
+	Start spawn_child on the spawn stack, directly in the cgroup of the
+	service. Unlike clone, the clone3 system call has no libc wrapper
+	that switches to the new stack, and the child must not return into
+	our stack frame, so the child side is done in assembly: it calls
+	spawn_child on the new stack and exits with its return value.
+*/
+static pid_t vfork_into_cgroup(spawn_args_t *args, int *pidfd)
+{
+#if defined(__x86_64__) && defined(SYS_clone3) && defined(CLONE_INTO_CGROUP)
+	struct clone_args cl;
+	long ret = SYS_clone3;
+
+	memset(&cl, 0, sizeof(cl));
+	cl.flags = CLONE_VM | CLONE_VFORK | CLONE_PIDFD | CLONE_INTO_CGROUP;
+	cl.pidfd = (uintptr_t)pidfd;
+	cl.exit_signal = SIGCHLD;
+	cl.stack = (uintptr_t)spawn_stack;
+	cl.stack_size = SPAWN_STACK_SIZE;
+	cl.cgroup = args->svc->cgroup_fd;
+
+	__asm__ __volatile__ (
+		"syscall\n\t"
+		"test %%rax, %%rax\n\t"
+		"jnz 1f\n\t"
+		"mov %[arg], %%rdi\n\t"
+		"call *%[fn]\n\t"
+		"mov %%eax, %%edi\n\t"
+		"mov %[nr_exit], %%eax\n\t"
+		"syscall\n\t"
+		"hlt\n"
+		"1:\n\t"
+		: "+a" (ret)
+		: "D" (&cl), "S" (sizeof(cl)), [fn] "r" (spawn_child),
+		  [arg] "r" (args), [nr_exit] "i" (SYS_exit)
+		: "rcx", "r11", "memory");
+
+	if (ret < 0) {
+		errno = -ret;
+		return -1;
+	}
+
+	return ret;
+#else
+	(void)args;
+	(void)pidfd;
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+/*
+	Start a command of a service by cloning a child that shares our
+	address space. We are suspended until the child has
+	called execve or exited, so we skip copying our page tables and the
+	child can safely use the arguments prepared on our side.
+*/
+static pid_t runsvc_vfork(spawn_args_t *args, int *pidfd)
+{
+	struct rlimit rl;
+	pid_t pid;
+
+	if (spawn_stack == NULL) {
+		spawn_stack = mmap(NULL, SPAWN_STACK_SIZE,
+				   PROT_READ | PROT_WRITE,
+				   MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK,
+				   -1, 0);
+
+		if (spawn_stack == MAP_FAILED) {
+			spawn_stack = NULL;
+			perror("mmap");
+			return -1;
 		}
+	}
+
+	args->max_fd = 1024;
+
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY)
+		args->max_fd = rl.rlim_cur;
+
+	if (args->svc->cgroup_fd >= 0) {
+		pid = vfork_into_cgroup(args, pidfd);
+		if (pid != -1)
+			return pid;
+	}
 
-		do {
-			ret = waitpid(pid, &status, 0);
-		} while (ret != pid);
+	/* without clone3, the child joins its cgroup before executing */
+	open_cgroup_procs(args);
 
-		if (!WIFEXITED(status))
-			return EXIT_FAILURE;
+	/* have the kernel hand us a pidfd, so there is no window for reuse */
+	pid = clone(spawn_child, (char *)spawn_stack + SPAWN_STACK_SIZE,
+		    CLONE_VM | CLONE_VFORK | CLONE_PIDFD | SIGCHLD, args,
+		    pidfd);
 
-		if (WEXITSTATUS(status) != EXIT_SUCCESS)
-			return WEXITSTATUS(status);
+	if (pid == -1 && errno == EINVAL) {
+		*pidfd = -1;
+		pid = clone(spawn_child, (char *)spawn_stack + SPAWN_STACK_SIZE,
+			    CLONE_VM | CLONE_VFORK | SIGCHLD, args);
 	}
 
-	return EXIT_SUCCESS;
+	if (pid == -1)
+		perror("clone");
+
+	close_cgroup_procs(args);
+	return pid;
+}
+
+/*
+	Fork a child directly into the cgroup of the service, so that it
+	does not have to be migrated there, which is a lot more expensive.
+*/
+static pid_t fork_into_cgroup(int cgroup_fd, int *pidfd)
+{
+#if defined(SYS_clone3) && defined(CLONE_INTO_CGROUP)
+	struct clone_args args;
+
+	memset(&args, 0, sizeof(args));
+	args.flags = CLONE_PIDFD | CLONE_INTO_CGROUP;
+	args.pidfd = (uintptr_t)pidfd;
+	args.exit_signal = SIGCHLD;
+	args.cgroup = cgroup_fd;
+
+	return syscall(SYS_clone3, &args, sizeof(args));
+#else
+	(void)cgroup_fd;
+	(void)pidfd;
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+void runsvc_set_backend(int type)
+{
+	backend = type;
 }
 
-pid_t runsvc(service_t *svc)
+int runsvc_reload_env(void)
 {
+	char **envp = load_env(), **nenv;
+	size_t count;
+
+	if (envp == NULL)
+		return -1;
+
+	for (count = 0; envp[count] != NULL; ++count)
+		;
+
+	/* room for LISTEN_FDS, LISTEN_PID and NOTIFY_FD */
+	nenv = malloc(sizeof(nenv[0]) * (count + 4));
+	if (nenv == NULL) {
+		perror("runsvc");
+		free(envp);
+		return -1;
+	}
+
+	memcpy(nenv, envp, sizeof(nenv[0]) * count);
+
+	free(environment);
+	free(spawn_env);
+	environment = envp;
+	spawn_env = nenv;
+	env_count = count;
+	env_gen += 1;
+	return 0;
+}
+
+int runsvc_prepare(service_t *svc)
+{
+	exec_t *e;
+
+	if (environment == NULL && runsvc_reload_env())
+		return -1;
+
+	for (e = svc->exec; e != NULL; e = e->next) {
+		if (prepare_exec(e))
+			return -1;
+	}
+
+	return 0;
+}
+
+pid_t runsvc(service_t *svc, exec_t *e, int *pidfd)
+{
+	spawn_args_t args;
 	sigset_t mask;
+	int first;
 	pid_t pid;
 
-	pid = fork();
+	*pidfd = -1;
+
+	if (environment == NULL && runsvc_reload_env())
+		return -1;
+
+	if (prepare_exec(e))
+		return -1;
+
+	prepare_spawn(&args, svc, e);
+
+	if (backend == SPAWN_VFORK)
+		return runsvc_vfork(&args, pidfd);
+
+	pid = -1;
+	if (svc->cgroup_fd >= 0)
+		pid = fork_into_cgroup(svc->cgroup_fd, pidfd);
+
+	/* kernels before 5.7, the child joins its cgroup itself */
+	if (pid == -1) {
+		*pidfd = -1;
+		open_cgroup_procs(&args);
+		pid = fork();
+	}
 
 	if (pid == -1)
 		perror("fork");
@@ -160,19 +753,23 @@ pid_t runsvc(service_t *svc)
 		sigemptyset(&mask);
 		sigprocmask(SIG_SETMASK, &mask, NULL);
 
-		if (setup_env())
-			exit(EXIT_FAILURE);
+		join_cgroup(&args);
 
-		if (close_all_files())
+		first = setup_passed_fds(&args);
+		if (first < 0 || close_all_files(first))
 			exit(EXIT_FAILURE);
 
-		if (setup_tty(svc->ctty,
-			      (svc->flags & SVC_FLAG_TRUNCATE_OUT) != 0)) {
+		if (setup_tty(svc, e))
 			exit(EXIT_FAILURE);
-		}
 
-		exit(run_sequentially(svc->exec));
+		argv_exec(e, args.envp);
 	}
 
+	close_cgroup_procs(&args);
+
+	/* the child cannot be reaped before we get back to the main loop */
+	if (pid > 0 && *pidfd < 0)
+		*pidfd = open_pidfd(pid);
+
 	return pid;
 }
@@ -3,6 +3,8 @@
 
 #include "init.h"
 
+static const char *wait_line = NULL;
+
 void print_status(const char *msg, int type, bool update)
 {
 	const char *str;
@@ -22,10 +24,16 @@ void print_status(const char *msg, int type, bool update)
 		break;
 	}
 
-	if (update)
-		fputc('\r', stdout);
+	if (wait_line != NULL)
+		fputc((update && wait_line == msg) ? '\r' : '\n', stdout);
+
 	printf("[%s] %s", str, msg);
-	if (type != STATUS_WAIT)
+
+	if (type != STATUS_WAIT) {
 		fputc('\n', stdout);
+		wait_line = NULL;
+	} else {
+		wait_line = msg;
+	}
 	fflush(stdout);
 }
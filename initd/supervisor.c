@@ -1,7 +1,24 @@
 /* SPDX-License-Identifier: ISC */
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <fnmatch.h>
+
 #include "init.h"
 
+#ifndef P_PIDFD
+#define P_PIDFD 3
+#endif
+
+/* at most RESTART_BUDGET respawns of all services per RESTART_PERIOD ms */
+#define RESTART_BUDGET 20
+#define RESTART_PERIOD 1000
+
+/* grace period for services to exit on shutdown before they are killed */
+#define STOP_TIMEOUT 5000
+
 static service_list_t cfg;
+static bool scheduled[TGT_MAX];
 
 static int service_id = 1;
 static int target = -1;
@@ -10,65 +27,834 @@ static service_t *terminated = NULL;
 static service_t *queue = NULL;
 static service_t *completed = NULL;
 static service_t *failed = NULL;
+static service_t *delayed = NULL;
+static service_t *idle = NULL;
 static int singleshot = 0;
-static bool waiting = false;
+static int waiting = 0;
+static int starting = 0;	/* services that dependents wait on to be ready */
+static int num_ready = 0;
+static bool serial_boot = false;
+
+static int timerfd = -1;
+static int restart_budget = RESTART_BUDGET;
+static struct timespec budget_refill;
+static struct timespec stop_deadline;
+static bool stop_pending = false;
+
+static svc_table_t by_pid = SVC_TABLE_INIT(SVC_TABLE_PID);
+static svc_table_t by_fname = SVC_TABLE_INIT(SVC_TABLE_FNAME);
+static svc_table_t by_name = SVC_TABLE_INIT(SVC_TABLE_NAME);
+static svc_table_t unscheduled = SVC_TABLE_INIT(SVC_TABLE_FNAME);
+static service_t **by_id = NULL;
+static int by_id_size = 0;
+
+static int list_state(service_t **list, const service_t *svc)
+{
+	if (list == &running)
+		return (svc->flags & SVC_FLAG_READY) ? ESS_READY : ESS_RUNNING;
+	if (list == &completed)
+		return ESS_DONE;
+	if (list == &failed)
+		return ESS_FAILED;
+	if (list == &queue)
+		return ESS_ENQUEUED;
+	if (list == &delayed)
+		return ESS_BACKOFF;
+	if (list == &idle)
+		return ESS_IDLE;
+	return ESS_NONE;
+}
+
+static int assign_id(service_t *svc);
+
+static void record_time(service_t *svc, int which)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	svc->ts_mono[which] = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+	clock_gettime(CLOCK_BOOTTIME, &ts);
+	svc->ts_boot[which] = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+	Report a service being put on a list. The terminated list only
+	holds services until the main loop gets to them, so it is skipped.
+*/
+static void report_state(service_t **list, service_t *svc)
+{
+	int state = list_state(list, svc);
+
+	if (list == &terminated)
+		return;
+
+	/* a new run starts with the service being queued */
+	if (list == &queue) {
+		assign_id(svc);
+		memset(svc->ts_mono, 0, sizeof(svc->ts_mono));
+		memset(svc->ts_boot, 0, sizeof(svc->ts_boot));
+		record_time(svc, SVC_TS_ENQUEUED);
+		svchistory_add(svc, EHE_ENQUEUED, 0, 0);
+	}
+
+	svcevent_notify(svc, svc->state, state);
+	svc->state = state;
+}
+
+/* link a service in at pos, which is head or a next pointer on its list */
+static void list_link(service_t **head, service_t **pos, service_t *svc)
+{
+	svc->next = *pos;
+	if (svc->next != NULL)
+		svc->next->pprev = &svc->next;
+
+	svc->pprev = pos;
+	svc->list = head;
+	*pos = svc;
+}
+
+static void list_push(service_t **list, service_t *svc)
+{
+	list_link(list, list, svc);
+	report_state(list, svc);
+}
+
+static void list_append(service_t **list, service_t *svcs)
+{
+	service_t **tail = list, *next;
+
+	while (*tail != NULL)
+		tail = &(*tail)->next;
+
+	for (; svcs != NULL; svcs = next) {
+		next = svcs->next;
+		list_link(list, tail, svcs);
+		tail = &svcs->next;
+		report_state(list, svcs);
+	}
+}
+
+static void list_remove(service_t *svc)
+{
+	if (svc->pprev == NULL)
+		return;
+
+	*(svc->pprev) = svc->next;
+	if (svc->next != NULL)
+		svc->next->pprev = svc->pprev;
+
+	svc->next = NULL;
+	svc->pprev = NULL;
+	svc->list = NULL;
+}
+
+static void list_replace(service_t *old, service_t *svc)
+{
+	svc->next = old->next;
+	svc->pprev = old->pprev;
+	svc->list = old->list;
+
+	*(svc->pprev) = svc;
+	if (svc->next != NULL)
+		svc->next->pprev = &svc->next;
+
+	old->next = NULL;
+	old->pprev = NULL;
+	old->list = NULL;
+}
+
+static int assign_id(service_t *svc)
+{
+	service_t **new;
+	int size;
+
+	if (svc->id >= 1)
+		return 0;
+
+	if (service_id >= by_id_size) {
+		size = by_id_size > 0 ? by_id_size * 2 : 64;
+
+		new = realloc(by_id, sizeof(by_id[0]) * size);
+		if (new == NULL) {
+			perror("growing service ID table");
+			return -1;
+		}
+
+		memset(new + by_id_size, 0,
+		       sizeof(by_id[0]) * (size - by_id_size));
+		by_id = new;
+		by_id_size = size;
+	}
+
+	svc->id = service_id++;
+	by_id[svc->id] = svc;
+	return 0;
+}
+
+static service_t *find_by_id(int id)
+{
+	return (id >= 1 && id < by_id_size) ? by_id[id] : NULL;
+}
+
+static void index_service(service_t *svc)
+{
+	svc_table_insert(&by_fname, svc);
+	svc_table_insert(&by_name, svc);
+	runsvc_prepare(svc);
+
+	/*
+		Clients can connect from the moment a service is scheduled. If
+		that fails, it is retried once the service is dequeued, which
+		marks it as failed if the sockets still cannot be created.
+	*/
+	svcsock_open(svc);
+}
+
+static void adopt_service(service_t **list, service_t *svc)
+{
+	index_service(svc);
+	list_push(list, svc);
+}
+
+static void drop_service(service_t *svc)
+{
+	if (svc->list == &idle)
+		svcsock_unwatch(svc);
+
+	list_remove(svc);
+
+	if (find_by_id(svc->id) == svc)
+		by_id[svc->id] = NULL;
+
+	svc_table_remove(&by_fname, svc);
+	svc_table_remove(&by_name, svc);
+
+	svcsock_close(svc);
+	svccgroup_destroy(svc);
+	delsvc(svc);
+}
+
+static int index_list(svc_table_t *tbl, service_t *list)
+{
+	for (; list != NULL; list = list->next) {
+		if (svc_table_insert(tbl, list))
+			return -1;
+	}
+	return 0;
+}
+
+static void remove_not_in_list(service_t **current, const svc_table_t *list,
+			       int tgt)
+{
+	service_t *it = *current, *next;
+
+	for (; it != NULL; it = next) {
+		next = it->next;
+
+		if (it->target == tgt &&
+		    svc_table_find_fname(list, it->fname) == NULL) {
+			drop_service(it);
+		}
+	}
+}
+
+static bool name_listed(const char *list, int count, const char *name)
+{
+	int i;
+
+	for (i = 0; i < count; ++i) {
+		if (!strcmp(list, name))
+			return true;
+		list += strlen(list) + 1;
+	}
+
+	return false;
+}
+
+static void clear_dependents(service_t *svc)
+{
+	free(svc->dependents);
+	svc->dependents = NULL;
+	svc->num_dependents = 0;
+}
+
+/*
+	A queued service waits for services queued before it, for running
+	services that have not reported readiness yet and for services of
+	type wait that have not been handled as terminated yet.
+*/
+static bool blocks(const service_t *dep, const service_t *svc)
+{
+	if (svc->list != &queue)
+		return false;
+
+	if (dep->list == &queue)
+		return dep->queue_pos < svc->queue_pos;
+
+	if (dep->list != &running && dep->list != &terminated)
+		return false;
+
+	return dep->type == SVC_WAIT || (dep->flags & SVC_FLAG_WAIT_READY);
+}
+
+/*
+	The first pass only counts the edges of each service, so the arrays
+	can be allocated at their final size for the second one.
+*/
+static void add_edge(service_t *dep, service_t *svc, bool fill)
+{
+	if (!fill) {
+		dep->num_dependents += 1;
+		return;
+	}
+
+	if (dep->dependents == NULL)
+		return;
+
+	dep->dependents[dep->num_dependents++] = svc;
+	svc->pending += 1;
+}
+
+/* edges from the 'after' list of a queued service */
+static void link_after(service_t *svc, bool fill)
+{
+	const char *name = svc->after;
+	service_t *dep;
+	size_t pos;
+	int i;
+
+	for (i = 0; i < svc->num_after; ++i, name += strlen(name) + 1) {
+		pos = 0;
+		while ((dep = svc_table_find_name(&by_name, name, &pos))) {
+			if (blocks(dep, svc))
+				add_edge(dep, svc, fill);
+		}
+	}
+}
+
+/* edges from the 'before' list, unless also declared the other way */
+static void link_before(service_t *dep, bool fill)
+{
+	const char *name = dep->before;
+	service_t *svc;
+	size_t pos;
+	int i;
+
+	for (i = 0; i < dep->num_before; ++i, name += strlen(name) + 1) {
+		pos = 0;
+		while ((svc = svc_table_find_name(&by_name, name, &pos))) {
+			if (blocks(dep, svc) &&
+			    !name_listed(svc->after, svc->num_after, dep->name)) {
+				add_edge(dep, svc, fill);
+			}
+		}
+	}
+}
+
+static void link_list(service_t *list, bool fill)
+{
+	for (; list != NULL; list = list->next) {
+		if (list->list == &queue)
+			link_after(list, fill);
+		link_before(list, fill);
+	}
+}
+
+/* turn the queue into a chain that is processed strictly in order */
+static void link_serial(void)
+{
+	service_t *lists[] = { running, terminated }, *svc;
+	size_t i;
+
+	for (i = 0; i < sizeof(lists) / sizeof(lists[0]); ++i) {
+		for (svc = lists[i]; svc != NULL && queue != NULL;
+		     svc = svc->next) {
+			if (!blocks(svc, queue))
+				continue;
+
+			svc->dependents = calloc(1, sizeof(svc->dependents[0]));
+			add_edge(svc, queue, true);
+		}
+	}
+
+	for (svc = queue; svc != NULL && svc->next != NULL; svc = svc->next) {
+		svc->dependents = calloc(1, sizeof(svc->dependents[0]));
+		add_edge(svc, svc->next, true);
+	}
+}
+
+static void alloc_dependents(service_t *list)
+{
+	for (; list != NULL; list = list->next) {
+		if (list->num_dependents > 0) {
+			list->dependents = calloc(list->num_dependents,
+						  sizeof(list->dependents[0]));
+			if (list->dependents == NULL)
+				perror("building dependency graph");
+		}
+		list->num_dependents = 0;
+	}
+}
+
+static void count_blocking(service_t *list)
+{
+	for (; list != NULL; list = list->next) {
+		clear_dependents(list);
+
+		if (list->type == SVC_WAIT) {
+			waiting += 1;
+		} else if (list->type == SVC_ONCE) {
+			singleshot += 1;
+		}
+	}
+}
+
+/*
+	Recompute the dependency graph for all services that have not been
+	started yet. A service blocks its dependents until it has been
+	started, until it is ready if it reports readiness, or until it has
+	terminated if it is of type wait. Only edges pointing forward in the
+	topologically sorted queue are added, so a dependency cycle can never
+	stall the queue. Dependencies are looked up by name in the service
+	table, so this is linear in the number of declared dependencies.
+*/
+static void rebuild_graph(void)
+{
+	service_t *svc;
+	int pos = 0;
+
+	waiting = 0;
+	singleshot = 0;
+	num_ready = 0;
+
+	for (svc = queue; svc != NULL; svc = svc->next) {
+		clear_dependents(svc);
+		svc->pending = 0;
+		svc->queue_pos = pos++;
+	}
+
+	count_blocking(running);
+	count_blocking(terminated);
+
+	if (serial_boot) {
+		link_serial();
+	} else {
+		link_list(queue, false);
+		link_list(running, false);
+		link_list(terminated, false);
+
+		alloc_dependents(queue);
+		alloc_dependents(running);
+		alloc_dependents(terminated);
+
+		link_list(queue, true);
+		link_list(running, true);
+		link_list(terminated, true);
+	}
+
+	for (svc = queue; svc != NULL; svc = svc->next) {
+		if (svc->pending == 0)
+			num_ready += 1;
+	}
+}
+
+static void release_dependents(service_t *svc)
+{
+	int i;
+
+	for (i = 0; i < svc->num_dependents; ++i) {
+		if (--(svc->dependents[i]->pending) == 0)
+			num_ready += 1;
+	}
+
+	clear_dependents(svc);
+}
+
+/* don't hold up dependents of a service that never became ready */
+static void stop_waiting_ready(service_t *svc)
+{
+	svc->flags &= ~SVC_FLAG_WAIT_READY;
+	starting -= 1;
+	record_time(svc, SVC_TS_READY);
+	release_dependents(svc);
+}
+
+static service_t *dequeue_ready(void)
+{
+	service_t *svc = queue;
+
+	while (svc != NULL && svc->pending > 0)
+		svc = svc->next;
+
+	if (svc != NULL) {
+		list_remove(svc);
+		num_ready -= 1;
+	}
+
+	return svc;
+}
+
+/* services of the previous target that are still being stopped */
+static bool stopping_previous(void)
+{
+	service_t *svc;
+
+	if (target != TGT_REBOOT && target != TGT_SHUTDOWN)
+		return false;
+
+	for (svc = running; svc != NULL; svc = svc->next) {
+		if (svc->target != target)
+			return true;
+	}
+
+	return false;
+}
+
+static void check_target_completed(void)
+{
+	if (singleshot == 0 && waiting == 0 && starting == 0 &&
+	    queue == NULL && !stopping_previous()) {
+		target_completed(target);
+	}
+}
+
+static void handle_pidfd(int fd, uint32_t events, void *arg);
+static void stop_running(service_t *svc);
+
+static unsigned int exec_index(const service_t *svc, const exec_t *e)
+{
+	const exec_t *it;
+	unsigned int i = 0;
+
+	for (it = svc->exec; it != NULL && it != e; it = it->next)
+		++i;
+
+	return i;
+}
+
+static int start_command(service_t *svc, exec_t *e)
+{
+	svchistory_add(svc, EHE_EXEC_START, exec_index(svc, e), 0);
+	clock_gettime(CLOCK_MONOTONIC, &e->started);
+	e->exited = e->started;
+	e->status = -1;
+
+	svc->pid = runsvc(svc, e, &svc->pidfd);
+	if (svc->pid == -1)
+		return -1;
+
+	/* without a pidfd, the SIGCHLD path picks up the exit status */
+	if (svc->pidfd >= 0 &&
+	    evloop_add(svc->pidfd, EPOLLIN, handle_pidfd, svc)) {
+		close(svc->pidfd);
+		svc->pidfd = -1;
+	}
+
+	svc->current = e;
+	svc_table_insert(&by_pid, svc);
+	return 0;
+}
+
+static int send_signal(service_t *svc, int signo)
+{
+#ifdef SYS_pidfd_send_signal
+	if (svc->pidfd >= 0)
+		return syscall(SYS_pidfd_send_signal, svc->pidfd, signo, NULL, 0);
+#endif
+	return kill(svc->pid, signo);
+}
+
+static int start_service(service_t *svc)
+{
+	if (assign_id(svc))
+		goto fail;
+
+	if (svcready_start(svc))
+		goto fail;
+
+	/* without a cgroup, it runs in ours, like it always did */
+	svccgroup_create(svc);
+
+	memset(&svc->usage, 0, sizeof(svc->usage));
+	svc->term_signal = 0;
+	svc->run_time = 0;
+	svc->flags &= ~SVC_FLAG_CORE_DUMPED;
+
+	if (start_command(svc, svc->exec))
+		goto fail;
+
+	list_push(&running, svc);
+	return 0;
+fail:
+	print_status(svc->desc, STATUS_FAIL, false);
+	list_push(&completed, svc);
+	return -1;
+}
+
+static void timespec_add_ms(struct timespec *ts, unsigned int ms)
+{
+	ts->tv_sec += ms / 1000;
+	ts->tv_nsec += (long)(ms % 1000) * 1000000L;
+
+	if (ts->tv_nsec >= 1000000000L) {
+		ts->tv_sec += 1;
+		ts->tv_nsec -= 1000000000L;
+	}
+}
+
+static bool timespec_before(const struct timespec *a, const struct timespec *b)
+{
+	if (a->tv_sec != b->tv_sec)
+		return a->tv_sec < b->tv_sec;
+	return a->tv_nsec < b->tv_nsec;
+}
+
+static long timespec_diff_ms(const struct timespec *a, const struct timespec *b)
+{
+	return (a->tv_sec - b->tv_sec) * 1000L +
+	       (a->tv_nsec - b->tv_nsec) / 1000000L;
+}
+
+static void pick_earlier(struct timespec *next, bool *armed,
+			 const struct timespec *ts)
+{
+	if (!*armed || timespec_before(ts, next)) {
+		*next = *ts;
+		*armed = true;
+	}
+}
+
+/*
+	Arm the timer for the next respawn, the end of the shutdown grace
+	period, or the next service that runs out of time to become ready.
+*/
+static void arm_timer(void)
+{
+	struct itimerspec its;
+	bool armed = false;
+	service_t *svc;
+
+	memset(&its, 0, sizeof(its));
+
+	for (svc = delayed; svc != NULL; svc = svc->next)
+		pick_earlier(&its.it_value, &armed, &svc->respawn_at);
+
+	if (delayed != NULL && restart_budget == 0 &&
+	    timespec_before(&its.it_value, &budget_refill)) {
+		its.it_value = budget_refill;
+	}
+
+	if (stop_pending)
+		pick_earlier(&its.it_value, &armed, &stop_deadline);
+
+	for (svc = running; svc != NULL; svc = svc->next) {
+		if (!(svc->flags & SVC_FLAG_WAIT_READY) || svc->ready_timeout == 0)
+			continue;
+
+		pick_earlier(&its.it_value, &armed, &svc->ready_deadline);
+	}
+
+	/* an all zero expiry time would disarm the timer */
+	if (armed && its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0)
+		its.it_value.tv_nsec = 1;
+
+	if (timerfd >= 0 &&
+	    timerfd_settime(timerfd, TFD_TIMER_ABSTIME, &its, NULL) != 0) {
+		perror("timerfd_settime");
+	}
+}
+
+/*
+	Decide when to respawn a service that terminated, doubling the
+	delay with every respawn and resetting it once the service stayed
+	up for the maximum delay. The actual delay is picked at random from
+	the upper half, so services that failed together don't come back in
+	lock step. Returns -1 if the service exceeded its respawn window.
+*/
+static int schedule_respawn(service_t *svc)
+{
+	struct timespec now;
+	unsigned int delay;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	if (svc->window_count > 0) {
+		if (svc->window_respawns == 0 ||
+		    timespec_diff_ms(&now, &svc->window_start) >=
+		    (long)svc->window_time * 1000L) {
+			svc->window_start = now;
+			svc->window_respawns = 0;
+		}
+
+		if (++svc->window_respawns > svc->window_count)
+			return -1;
+	}
+
+	if (svc->exec != NULL &&
+	    timespec_diff_ms(&now, &svc->exec->started) >=
+	    (long)svc->backoff_max) {
+		svc->backoff = 0;
+	}
+
+	if (svc->backoff == 0) {
+		svc->backoff = svc->backoff_min;
+	} else if (svc->backoff >= svc->backoff_max / 2) {
+		svc->backoff = svc->backoff_max;
+	} else {
+		svc->backoff *= 2;
+	}
+
+	delay = svc->backoff / 2;
+	if (svc->backoff > 0)
+		delay += random() % (svc->backoff - delay + 1);
+
+	svc->respawn_at = now;
+	timespec_add_ms(&svc->respawn_at, delay);
+
+	svchistory_add(svc, EHE_BACKOFF, 0, delay);
+	list_push(&delayed, svc);
+	arm_timer();
+	return 0;
+}
+
+/* kill what is left of the services of the previous target */
+static void kill_previous(void)
+{
+	service_t *svc;
+
+	for (svc = running; svc != NULL; svc = svc->next) {
+		if (svc->target == target)
+			continue;
+
+		if (svccgroup_kill(svc) != 0 &&
+		    !(svc->flags & SVC_FLAG_STOPPING)) {
+			send_signal(svc, SIGKILL);
+		}
+	}
+}
+
+static void handle_timer(int fd, uint32_t events, void *arg)
+{
+	struct timespec now;
+	service_t *svc, *next;
+	uint64_t expirations;
+	(void)events;
+	(void)arg;
+
+	while (read(fd, &expirations, sizeof(expirations)) < 0 &&
+	       errno == EINTR)
+		;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	if (stop_pending && !timespec_before(&now, &stop_deadline)) {
+		stop_pending = false;
+		kill_previous();
+	}
+
+	if (!timespec_before(&now, &budget_refill)) {
+		restart_budget = RESTART_BUDGET;
+		budget_refill = now;
+		timespec_add_ms(&budget_refill, RESTART_PERIOD);
+	}
+
+	for (svc = delayed; svc != NULL && restart_budget > 0; svc = next) {
+		next = svc->next;
+
+		if (timespec_before(&now, &svc->respawn_at))
+			continue;
+
+		restart_budget -= 1;
+		list_remove(svc);
+		start_service(svc);
+	}
+
+	for (svc = running; svc != NULL; svc = svc->next) {
+		if (!(svc->flags & SVC_FLAG_WAIT_READY) ||
+		    svc->ready_timeout == 0 ||
+		    timespec_before(&now, &svc->ready_deadline)) {
+			continue;
+		}
+
+		print_status(svc->desc, STATUS_FAIL, true);
+		stop_waiting_ready(svc);
+		check_target_completed();
+	}
+
+	arm_timer();
+}
+
+static void cancel_respawn(service_t *svc)
+{
+	list_remove(svc);
+	list_push(&completed, svc);
+	arm_timer();
+}
 
-static bool find_service(service_t *list, service_t *svc)
+unsigned int supervisor_respawn_delay(const service_t *svc)
 {
-	while (list != NULL) {
-		if (strcmp(list->fname, svc->fname) == 0)
-			return true;
+	struct timespec now;
+	long ms;
 
-		list = list->next;
-	}
-	return false;
+	if (svc->list != &delayed)
+		return 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ms = timespec_diff_ms(&svc->respawn_at, &now);
+
+	return ms > 0 ? ms : 0;
 }
 
-static void remove_not_in_list(service_t **current, service_t *list, int tgt)
+/*
+	Park a lazy service until a client uses one of its sockets. Returns
+	-1 if the event loop cannot watch them, so it is started right away
+	instead.
+*/
+static int make_idle(service_t *svc)
 {
-	service_t *it = *current, *prev = NULL;
+	svc->flags &= ~SVC_FLAG_ACTIVATED;
 
-	while (it != NULL) {
-		if (it->target == tgt && !find_service(list, it)) {
-			if (prev == NULL) {
-				delsvc(it);
-				*current = (*current)->next;
-				it = *current;
-			} else {
-				prev->next = it->next;
-				delsvc(it);
-				it = prev->next;
-			}
-		} else {
-			prev = it;
-			it = it->next;
-		}
-	}
+	if (svcsock_watch(svc))
+		return -1;
+
+	svchistory_add(svc, EHE_IDLE, 0, 0);
+	list_push(&idle, svc);
+	return 0;
 }
 
-static bool have_service(service_t *svc)
+static void cancel_idle(service_t *svc)
 {
-	return find_service(running, svc) || find_service(terminated, svc) ||
-		find_service(queue, svc) || find_service(completed, svc) ||
-		find_service(failed, svc);
+	svcsock_unwatch(svc);
+	list_remove(svc);
+	list_push(&completed, svc);
 }
 
-static int start_service(service_t *svc)
+void supervisor_service_activated(service_t *svc)
 {
-	if (svc->id < 1)
-		svc->id = service_id++;
+	if (svc->list != &idle)
+		return;
 
-	svc->pid = runsvc(svc);
-	if (svc->pid == -1) {
-		print_status(svc->desc, STATUS_FAIL, false);
-		svc->next = completed;
-		completed = svc;
-		return -1;
-	}
+	list_remove(svc);
+	svc->flags |= SVC_FLAG_ACTIVATED;
+	list_push(&queue, svc);
+	rebuild_graph();
+}
 
-	svc->next = running;
-	running = svc;
-	return 0;
+void supervisor_service_gone(service_t *svc)
+{
+	if (!(svc->flags & SVC_FLAG_STOPPING))
+		return;
+
+	/*
+		Some kernels also kill children that are cloned into a cgroup
+		after cgroup.kill was used on it, so the next run gets a new one.
+	*/
+	svccgroup_destroy(svc);
+
+	svc->flags &= ~SVC_FLAG_STOPPING;
+	list_remove(svc);
+	list_push(&terminated, svc);
 }
 
 static void handle_terminated_service(service_t *svc)
@@ -81,24 +867,27 @@ static void handle_terminated_service(service_t *svc)
 		if (svc->flags & SVC_FLAG_ADMIN_STOPPED)
 			break;
 
-		if (svc->rspwn_limit > 0) {
-			svc->rspwn_count += 1;
+		svc->rspwn_count += 1;
 
-			if (svc->rspwn_count >= svc->rspwn_limit) {
-				print_status(svc->desc, STATUS_FAIL, false);
-				goto out_failure;
-			}
+		if (svc->rspwn_limit > 0 &&
+		    svc->rspwn_count >= svc->rspwn_limit) {
+			print_status(svc->desc, STATUS_FAIL, false);
+			goto out_failure;
 		}
 
-		start_service(svc);
+		if (schedule_respawn(svc)) {
+			print_status(svc->desc, STATUS_FAIL, false);
+			goto out_failure;
+		}
 		return;
 	case SVC_WAIT:
-		waiting = false;
+		waiting -= 1;
+		record_time(svc, SVC_TS_READY);
+		release_dependents(svc);
 		print_status(svc->desc,
 			     svc->status == EXIT_SUCCESS ?
 			     STATUS_OK : STATUS_FAIL, true);
-		if (singleshot == 0 && queue == NULL)
-			target_completed(target);
+		check_target_completed();
 		if (svc->status != EXIT_SUCCESS)
 			goto out_failure;
 		break;
@@ -107,41 +896,189 @@ static void handle_terminated_service(service_t *svc)
 		print_status(svc->desc,
 			     svc->status == EXIT_SUCCESS ?
 			     STATUS_OK : STATUS_FAIL, false);
-		if (singleshot == 0 && queue == NULL && !waiting)
-			target_completed(target);
+		check_target_completed();
 		if (svc->status != EXIT_SUCCESS)
 			goto out_failure;
+
+		/* a lazy service that is done waits for the next client */
+		if ((svc->flags & SVC_FLAG_LAZY) &&
+		    !(svc->flags & SVC_FLAG_ADMIN_STOPPED) &&
+		    target != TGT_REBOOT && target != TGT_SHUTDOWN &&
+		    make_idle(svc) == 0) {
+			return;
+		}
 		break;
 	}
-	svc->next = completed;
-	completed = svc;
+	list_push(&completed, svc);
 	return;
 out_failure:
-	svc->next = failed;
-	failed = svc;
+	list_push(&failed, svc);
 }
 
-void supervisor_handle_exited(pid_t pid, int status)
+static void service_exited(service_t *svc, int status)
 {
-	service_t *prev = NULL, *svc = running;
+	svc_table_remove(&by_pid, svc);
 
-	while (svc != NULL && svc->pid != pid) {
-		prev = svc;
-		svc = svc->next;
+	if (svc->current != NULL) {
+		clock_gettime(CLOCK_MONOTONIC, &svc->current->exited);
+		svc->current->status = status;
+
+		svchistory_add(svc, EHE_EXEC_END,
+			       exec_index(svc, svc->current), status);
+
+		/* advance to the next command in the exec block */
+		if (status == EXIT_SUCCESS && svc->current->next != NULL &&
+		    !(svc->flags & SVC_FLAG_ADMIN_STOPPED)) {
+			if (start_command(svc, svc->current->next) == 0)
+				return;
+
+			status = EXIT_FAILURE;
+		}
 	}
 
-	if (svc == NULL)
+	if (svc->current != NULL) {
+		svc->run_time = timespec_diff_ms(&svc->current->exited,
+						 &svc->exec->started);
+	}
+
+	record_time(svc, SVC_TS_EXITED);
+	svchistory_add(svc, EHE_EXITED, 0, status);
+	svcready_stop(svc);
+
+	if (svc->flags & SVC_FLAG_WAIT_READY)
+		stop_waiting_ready(svc);
+
+	svc->status = status;
+
+	/*
+		Whatever a stopped service left behind, e.g. daemons that
+		detached from it, is killed. It is only gone once its cgroup
+		is empty.
+	*/
+	if ((svc->flags & SVC_FLAG_ADMIN_STOPPED) && svccgroup_populated(svc) &&
+	    svccgroup_kill(svc) == 0) {
+		svc->flags |= SVC_FLAG_STOPPING;
 		return;
+	}
+
+	list_remove(svc);
+	list_push(&terminated, svc);
+}
+
+static uint64_t timeval_us(const struct timeval *tv)
+{
+	return (uint64_t)tv->tv_sec * 1000000ULL + tv->tv_usec;
+}
+
+static void add_usage(svc_usage_t *usage, const struct rusage *ru)
+{
+	usage->utime += timeval_us(&ru->ru_utime);
+	usage->stime += timeval_us(&ru->ru_stime);
+	usage->minflt += ru->ru_minflt;
+	usage->majflt += ru->ru_majflt;
+
+	if ((uint64_t)ru->ru_maxrss > usage->maxrss)
+		usage->maxrss = ru->ru_maxrss;
+}
+
+/*
+	Reap exactly the process of the service, through its pidfd if it has
+	one. Returns -1 if the process has not exited yet. The raw system call
+	is used, as it also reports the resource usage of the process, which
+	the libc wrapper drops.
+*/
+static int collect_service(service_t *svc, idtype_t type, id_t id)
+{
+	struct rusage ru;
+	siginfo_t info;
+	int status;
+
+	memset(&info, 0, sizeof(info));
+	memset(&ru, 0, sizeof(ru));
+
+	if (syscall(SYS_waitid, type, id, &info, WEXITED | WNOHANG, &ru) != 0 ||
+	    info.si_pid == 0) {
+		return -1;
+	}
+
+	if (svc->pidfd >= 0) {
+		evloop_remove(svc->pidfd);
+		close(svc->pidfd);
+		svc->pidfd = -1;
+	}
+
+	add_usage(&svc->usage, &ru);
+	add_usage(&svc->total_usage, &ru);
 
-	if (prev != NULL) {
-		prev->next = svc->next;
+	if (info.si_code == CLD_EXITED) {
+		status = info.si_status;
+		svc->term_signal = 0;
 	} else {
-		running = svc->next;
+		status = EXIT_FAILURE;
+		svc->term_signal = info.si_status;
 	}
 
-	svc->status = status;
-	svc->next = terminated;
-	terminated = svc;
+	if (info.si_code == CLD_DUMPED) {
+		svc->flags |= SVC_FLAG_CORE_DUMPED;
+	} else {
+		svc->flags &= ~SVC_FLAG_CORE_DUMPED;
+	}
+
+	service_exited(svc, status);
+	return 0;
+}
+
+static void handle_pidfd(int fd, uint32_t events, void *arg)
+{
+	(void)events;
+	collect_service(arg, P_PIDFD, fd);
+}
+
+void supervisor_service_ready(service_t *svc)
+{
+	if (svc->list != &running || (svc->flags & SVC_FLAG_READY))
+		return;
+
+	svc->flags |= SVC_FLAG_READY;
+	svchistory_add(svc, EHE_READY, 0, 0);
+	report_state(&running, svc);
+
+	if (svc->flags & SVC_FLAG_WAIT_READY) {
+		svc->flags &= ~SVC_FLAG_WAIT_READY;
+		starting -= 1;
+		record_time(svc, SVC_TS_READY);
+		print_status(svc->desc, STATUS_STARTED, true);
+		release_dependents(svc);
+		check_target_completed();
+	}
+}
+
+bool supervisor_handle_exited(pid_t pid)
+{
+	service_t *svc = svc_table_find_pid(&by_pid, pid);
+
+	if (svc == NULL)
+		return false;
+
+	collect_service(svc, P_PID, pid);
+	return true;
+}
+
+/*
+	Services of targets that are not scheduled yet are indexed by file
+	name and linked like the other lists, so a single one can be
+	replaced without walking all of them.
+*/
+static void track_unscheduled(int tgt)
+{
+	service_t **pos, *svc;
+
+	for (pos = &cfg.targets[tgt]; *pos != NULL; pos = &svc->next) {
+		svc = *pos;
+		svc->pprev = pos;
+		svc->list = &cfg.targets[tgt];
+		svc_table_insert(&unscheduled, svc);
+	}
 }
 
 void supervisor_set_target(int next)
@@ -152,76 +1089,217 @@ void supervisor_set_target(int next)
 		return;
 
 	if (next == TGT_REBOOT || next == TGT_SHUTDOWN) {
-		while (queue != NULL) {
-			svc = queue;
-			queue = queue->next;
-			delsvc(svc);
+		while (queue != NULL)
+			drop_service(queue);
+		while (delayed != NULL)
+			cancel_respawn(delayed);
+		while (idle != NULL)
+			cancel_idle(idle);
+
+		/* the new target starts once these are gone */
+		for (svc = running; svc != NULL; svc = svc->next)
+			stop_running(svc);
+
+		if (running != NULL) {
+			clock_gettime(CLOCK_MONOTONIC, &stop_deadline);
+			timespec_add_ms(&stop_deadline, STOP_TIMEOUT);
+			stop_pending = true;
+			arm_timer();
 		}
 	}
 
-	if (queue != NULL) {
-		for (svc = queue; svc->next != NULL; svc = svc->next)
-			;
-		svc->next = cfg.targets[next];
-	} else {
-		queue = cfg.targets[next];
+	cfg.targets[next] = svc_tsort(cfg.targets[next]);
+
+	for (svc = cfg.targets[next]; svc != NULL; svc = svc->next) {
+		svc_table_remove(&unscheduled, svc);
+		index_service(svc);
 	}
 
+	list_append(&queue, cfg.targets[next]);
 	cfg.targets[next] = NULL;
+	scheduled[next] = true;
 	target = next;
+	rebuild_graph();
 }
 
-void supervisor_init(void)
+void supervisor_init(bool serial)
 {
-	int status = STATUS_OK;
+	int i, status = STATUS_OK;
+
+	serial_boot = serial;
+
+	srandom(time(NULL) ^ getpid());
+
+	timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (timerfd < 0) {
+		perror("timerfd_create");
+	} else if (evloop_add(timerfd, EPOLLIN, handle_timer, NULL)) {
+		close(timerfd);
+		timerfd = -1;
+	}
 
 	if (svcscan(SVCDIR, &cfg))
 		status = STATUS_FAIL;
 
-	target = TGT_BOOT;
-	queue = cfg.targets[TGT_BOOT];
-	cfg.targets[TGT_BOOT] = NULL;
+	for (i = 0; i < TGT_MAX; ++i)
+		track_unscheduled(i);
+
+	supervisor_set_target(TGT_BOOT);
 
 	print_status("reading configuration from " SVCDIR, status, false);
 }
 
 void supervisor_reload_config(void)
 {
+	svc_table_t index = SVC_TABLE_INIT(SVC_TABLE_FNAME);
 	service_list_t newcfg;
 	service_t *svc;
+	size_t j;
 	int i;
 
 	if (svcscan(SVCDIR, &newcfg))
 		return;
 
 	for (i = 0; i < TGT_MAX; ++i) {
-		if (cfg.targets[i] == NULL) {
-			remove_not_in_list(&queue, newcfg.targets[i], i);
-			remove_not_in_list(&terminated, newcfg.targets[i], i);
-			remove_not_in_list(&completed, newcfg.targets[i], i);
-			remove_not_in_list(&failed, newcfg.targets[i], i);
+		if (scheduled[i]) {
+			if (index_list(&index, newcfg.targets[i]) == 0) {
+				remove_not_in_list(&queue, &index, i);
+				remove_not_in_list(&terminated, &index, i);
+				remove_not_in_list(&completed, &index, i);
+				remove_not_in_list(&failed, &index, i);
+				remove_not_in_list(&delayed, &index, i);
+				remove_not_in_list(&idle, &index, i);
+			}
+
+			svc_table_cleanup(&index);
 
 			while (newcfg.targets[i] != NULL) {
 				svc = newcfg.targets[i];
 				newcfg.targets[i] = svc->next;
 
-				if (have_service(svc)) {
+				if (svc_table_find_fname(&by_fname,
+							 svc->fname) != NULL ||
+				    assign_id(svc) != 0) {
 					delsvc(svc);
 				} else {
-					svc->id = service_id++;
 					svc->status = EXIT_SUCCESS;
-					svc->next = completed;
-					completed = svc;
+					adopt_service(&completed, svc);
 				}
 			}
 		} else {
+			for (svc = cfg.targets[i]; svc != NULL; svc = svc->next)
+				svc_table_remove(&unscheduled, svc);
+
 			svc = cfg.targets[i];
 			cfg.targets[i] = newcfg.targets[i];
 			newcfg.targets[i] = svc;
+			track_unscheduled(i);
 		}
 	}
 
 	del_svc_list(&newcfg);
+
+	/* the environment may have changed, so look up commands again */
+	for (j = 0; by_fname.slots != NULL && j <= by_fname.mask; ++j) {
+		if (by_fname.slots[j] != NULL)
+			runsvc_prepare(by_fname.slots[j]);
+	}
+
+	rebuild_graph();
+}
+
+static service_t *remove_unscheduled(const char *fname)
+{
+	service_t *svc = svc_table_find_fname(&unscheduled, fname);
+
+	if (svc != NULL) {
+		svc_table_remove(&unscheduled, svc);
+		list_remove(svc);
+	}
+
+	return svc;
+}
+
+void supervisor_reload_service(int dirfd, const char *fname)
+{
+	service_t *old, *svc = NULL;
+	bool relink;
+
+	if (faccessat(dirfd, fname, F_OK, AT_SYMLINK_NOFOLLOW) == 0) {
+		svc = rdsvc(dirfd, fname);
+
+		/* keep the old configuration if the new one is broken */
+		if (svc == NULL)
+			return;
+	}
+
+	/* unscheduled targets are sorted once they are scheduled */
+	old = remove_unscheduled(fname);
+	if (old != NULL)
+		delsvc(old);
+
+	old = svc_table_find_fname(&by_fname, fname);
+
+	/* running services and services about to respawn keep their state */
+	if (old != NULL && old->list != &running && old->list != &terminated &&
+	    old->list != &delayed) {
+		relink = old->list == &queue;
+
+		if (svc != NULL && svc->target == old->target) {
+			svc->id = old->id;
+			svc->status = old->status;
+			svc->state = old->state;
+			if (find_by_id(svc->id) == old)
+				by_id[svc->id] = svc;
+			old->id = -1;
+
+			if (old->list == &idle)
+				svcsock_unwatch(old);
+
+			svcsock_take_over(svc, old);
+			index_service(svc);
+			list_replace(old, svc);
+
+			/* wake it up if it is no longer lazy */
+			if (svc->list == &idle &&
+			    (!(svc->flags & SVC_FLAG_LAZY) ||
+			     svcsock_watch(svc) != 0)) {
+				list_remove(svc);
+				svc->flags |= SVC_FLAG_ACTIVATED;
+				list_push(&queue, svc);
+			}
+
+			relink = relink || svc->list == &queue;
+			svc = NULL;
+		}
+
+		drop_service(old);
+
+		/* the graph only covers the queue and what it waits for */
+		if (relink)
+			rebuild_graph();
+	} else if (old != NULL) {
+		delsvc(svc);
+		svc = NULL;
+	}
+
+	if (svc == NULL)
+		return;
+
+	if (scheduled[svc->target]) {
+		if (assign_id(svc)) {
+			delsvc(svc);
+			return;
+		}
+
+		svc->status = EXIT_SUCCESS;
+		adopt_service(&completed, svc);
+	} else if (svc_table_insert(&unscheduled, svc) == 0) {
+		list_link(&cfg.targets[svc->target],
+			  &cfg.targets[svc->target], svc);
+	} else {
+		delsvc(svc);
+	}
 }
 
 bool supervisor_process_queues(void)
@@ -230,132 +1308,338 @@ bool supervisor_process_queues(void)
 
 	if (terminated != NULL) {
 		svc = terminated;
-		terminated = terminated->next;
+		list_remove(svc);
 
 		handle_terminated_service(svc);
+		check_target_completed();
 		return true;
 	}
 
-	if (waiting || queue == NULL)
+	if (num_ready == 0 || stopping_previous())
+		return false;
+
+	svc = dequeue_ready();
+	if (svc == NULL)
 		return false;
 
-	svc = queue;
-	queue = queue->next;
+	/* neither started nor parked without the sockets it is passed */
+	if (svcsock_open(svc)) {
+		record_time(svc, SVC_TS_READY);
+		print_status(svc->desc, STATUS_FAIL, false);
+		svc->status = EXIT_FAILURE;
+		list_push(&failed, svc);
+		release_dependents(svc);
+		goto out;
+	}
+
+	/* the sockets are there, so dependents can go ahead already */
+	if ((svc->flags & SVC_FLAG_LAZY) && !(svc->flags & SVC_FLAG_ACTIVATED) &&
+	    target != TGT_REBOOT && target != TGT_SHUTDOWN &&
+	    make_idle(svc) == 0) {
+		record_time(svc, SVC_TS_READY);
+		release_dependents(svc);
+		goto out;
+	}
 
 	if (!(svc->flags & SVC_FLAG_HAS_EXEC)) {
+		record_time(svc, SVC_TS_READY);
+		svchistory_add(svc, EHE_EXITED, 0, EXIT_SUCCESS);
 		print_status(svc->desc, STATUS_OK, false);
 		svc->status = EXIT_SUCCESS;
-		svc->next = completed;
-		completed = svc;
+		list_push(&completed, svc);
+		release_dependents(svc);
 		goto out;
 	}
 
-	if (start_service(svc) != 0)
-		return true;
+	/* respawns are not recorded, only the start that boot waits for */
+	record_time(svc, SVC_TS_FORKED);
+
+	if (start_service(svc) != 0) {
+		release_dependents(svc);
+		goto out;
+	}
+
+	/* with the fork backend, this is when fork returned */
+	record_time(svc, SVC_TS_EXECED);
 
 	switch (svc->type) {
 	case SVC_WAIT:
 		print_status(svc->desc, STATUS_WAIT, false);
-		waiting = true;
+		waiting += 1;
 		break;
 	case SVC_RESPAWN:
-		print_status(svc->desc, STATUS_STARTED, false);
-		break;
 	case SVC_ONCE:
-		singleshot += 1;
+		if (svc->type == SVC_ONCE)
+			singleshot += 1;
+
+		/* dependents wait until the service says it is ready */
+		if ((svc->flags & (SVC_FLAG_READY_NOTIFY | SVC_FLAG_READY_FILE)) &&
+		    !(svc->flags & SVC_FLAG_READY)) {
+			print_status(svc->desc, STATUS_WAIT, false);
+			svc->flags |= SVC_FLAG_WAIT_READY;
+			starting += 1;
+
+			if (svc->ready_timeout > 0) {
+				clock_gettime(CLOCK_MONOTONIC,
+					      &svc->ready_deadline);
+				svc->ready_deadline.tv_sec += svc->ready_timeout;
+				arm_timer();
+			}
+			break;
+		}
+
+		if (svc->type == SVC_RESPAWN)
+			print_status(svc->desc, STATUS_STARTED, false);
+		record_time(svc, SVC_TS_READY);
+		release_dependents(svc);
 		break;
 	}
 out:
-	if (singleshot == 0 && queue == NULL && !waiting)
-		target_completed(target);
+	check_target_completed();
 	return true;
 }
 
-static int send_svc_list(int fd, const void *dst, size_t addrlen,
-			 E_SERVICE_STATE filter, E_SERVICE_STATE state,
-			 service_t *list)
+static int send_svc_list(status_writer_t *w, E_SERVICE_STATE filter,
+			 E_SERVICE_STATE state, service_t *list)
 {
-	if (filter != ESS_NONE && filter != state)
-		return 0;
+	E_SERVICE_STATE svc_state;
 
-	while (list != NULL) {
-		if (init_socket_send_status(fd, dst, addrlen, state, list))
-			return -1;
+	for (; list != NULL; list = list->next) {
+		svc_state = state;
+		if (state == ESS_RUNNING && (list->flags & SVC_FLAG_READY))
+			svc_state = ESS_READY;
+
+		if (filter != ESS_NONE &&
+		    filter != init_status_writer_state(w, svc_state)) {
+			continue;
+		}
 
-		list = list->next;
+		if (init_status_writer_add(w, svc_state, list))
+			return -1;
 	}
 
 	return 0;
 }
 
-void supervisor_answer_status_request(int fd, const void *dst, size_t addrlen,
-				      E_SERVICE_STATE filter)
+void supervisor_answer_status_request(ctlclient_t *cl, E_SERVICE_STATE filter,
+				      int version)
 {
-	if (send_svc_list(fd, dst, addrlen, filter, ESS_RUNNING, running))
+	status_writer_t w;
+
+	init_status_writer_init(&w, cl, version);
+
+	if (send_svc_list(&w, filter, ESS_RUNNING, running))
+		return;
+	if (send_svc_list(&w, filter, ESS_DONE, completed))
+		return;
+	if (send_svc_list(&w, filter, ESS_FAILED, failed))
 		return;
-	if (send_svc_list(fd, dst, addrlen, filter, ESS_DONE, completed))
+	if (send_svc_list(&w, filter, ESS_BACKOFF, delayed))
 		return;
-	if (send_svc_list(fd, dst, addrlen, filter, ESS_FAILED, failed))
+	if (send_svc_list(&w, filter, ESS_IDLE, idle))
 		return;
-	if (send_svc_list(fd, dst, addrlen, filter, ESS_ENQUEUED, queue))
+	if (send_svc_list(&w, filter, ESS_ENQUEUED, queue))
 		return;
-	if (send_svc_list(fd, dst, addrlen, filter, ESS_ENQUEUED, terminated))
+	if (send_svc_list(&w, filter, ESS_ENQUEUED, terminated))
 		return;
-	init_socket_send_status(fd, dst, addrlen, ESS_NONE, NULL);
+	init_status_writer_finish(&w);
 }
 
-static service_t *remove_by_id(service_t **list, int id)
+static int send_timeline_list(status_writer_t *w, service_t *list)
 {
-	service_t *svc = *list, *prev = NULL;
+	for (; list != NULL; list = list->next) {
+		if (init_timeline_writer_add(w, list->state, list))
+			return -1;
+	}
 
-	while (svc != NULL && svc->id != id) {
-		prev = svc;
-		svc = svc->next;
+	return 0;
+}
+
+void supervisor_answer_timeline_request(ctlclient_t *cl)
+{
+	service_t **lists[] = {
+		&running, &completed, &failed, &delayed, &idle, &queue,
+		&terminated,
+	};
+	status_writer_t w;
+	size_t i;
+
+	init_status_writer_init(&w, cl, INIT_TIMELINE_VERSION);
+
+	for (i = 0; i < sizeof(lists) / sizeof(lists[0]); ++i) {
+		if (send_timeline_list(&w, *(lists[i])))
+			return;
 	}
 
-	if (svc != NULL) {
-		if (prev == NULL) {
-			*list = svc->next;
-		} else {
-			prev->next = svc->next;
-		}
+	init_status_writer_finish(&w);
+}
+
+static bool start_stopped(service_t *svc)
+{
+	if (svc->list == &idle) {
+		svcsock_unwatch(svc);
+		list_remove(svc);
+		svc->flags |= SVC_FLAG_ACTIVATED;
+		list_push(&queue, svc);
+		return true;
 	}
 
-	return svc;
+	if (svc->list != &completed && svc->list != &failed)
+		return false;
+
+	list_remove(svc);
+	svc->rspwn_count = 0;
+	svc->backoff = 0;
+	svc->window_respawns = 0;
+	svc->flags &= ~SVC_FLAG_ADMIN_STOPPED;
+	list_push(&queue, svc);
+	return true;
+}
+
+static void stop_running(service_t *svc)
+{
+	if (svc->list != &running && svc->list != &delayed &&
+	    svc->list != &idle) {
+		return;
+	}
+
+	if (svc->flags & SVC_FLAG_STOPPING)
+		return;
+
+	svc->flags |= SVC_FLAG_ADMIN_STOPPED;
+	svchistory_add(svc, EHE_STOP, 0, 0);
+
+	if (svc->list == &running) {
+		/* the rest of its cgroup goes once the process exited */
+		send_signal(svc, SIGTERM);
+	} else if (svc->list == &delayed) {
+		cancel_respawn(svc);
+	} else {
+		cancel_idle(svc);
+	}
 }
 
 void supervisor_start(int id)
 {
-	service_t *svc;
+	service_t *svc = find_by_id(id);
 
-	svc = remove_by_id(&completed, id);
-	if (svc != NULL)
-		goto found;
+	if (svc != NULL && start_stopped(svc))
+		rebuild_graph();
+}
+
+void supervisor_stop(int id)
+{
+	service_t *svc = find_by_id(id);
 
-	svc = remove_by_id(&failed, id);
 	if (svc != NULL)
-		goto found;
+		stop_running(svc);
+}
 
-	return;
-found:
-	svc->rspwn_count = 0;
-	svc->flags &= ~SVC_FLAG_ADMIN_STOPPED;
-	svc->next = queue;
-	queue = svc;
+typedef struct {
+	service_t **svcs;
+	size_t count;
+	size_t max;
+	unsigned int gen;	/* stamped on the services already added */
+} match_list_t;
+
+static unsigned int match_gen = 0;
+
+static int add_match(match_list_t *m, service_t *svc)
+{
+	size_t max = m->max ? m->max * 2 : 16;
+	service_t **new;
+
+	if (svc->match_gen == m->gen)
+		return 0;
+
+	if (m->count == m->max) {
+		new = realloc(m->svcs, max * sizeof(new[0]));
+		if (new == NULL) {
+			perror("matching services");
+			return -1;
+		}
+
+		m->svcs = new;
+		m->max = max;
+	}
+
+	m->svcs[m->count++] = svc;
+	svc->match_gen = m->gen;
+	return 0;
 }
 
-void supervisor_stop(int id)
+/*
+	Plain names are resolved through the name tables: a name with an
+	'@' can only match a file name, any other name matches all services
+	with that canonical name. Only glob patterns require looking at
+	every supervised service.
+*/
+static int collect_matches(match_list_t *m, const char *pattern)
 {
 	service_t *svc;
+	size_t i;
 
-	for (svc = running; svc != NULL; svc = svc->next) {
-		if (svc->id == id)
+	if (strpbrk(pattern, "*?[\\") == NULL) {
+		if (strchr(pattern, '@') != NULL) {
+			svc = svc_table_find_fname(&by_fname, pattern);
+			return svc == NULL ? 0 : add_match(m, svc);
+		}
+
+		i = 0;
+		while ((svc = svc_table_find_name(&by_name, pattern, &i))) {
+			if (add_match(m, svc))
+				return -1;
+		}
+		return 0;
+	}
+
+	for (i = 0; by_fname.slots != NULL && i <= by_fname.mask; ++i) {
+		svc = by_fname.slots[i];
+
+		if (svc == NULL)
+			continue;
+
+		if (fnmatch(pattern, svc->name, 0) == 0 ||
+		    fnmatch(pattern, svc->fname, 0) == 0) {
+			if (add_match(m, svc))
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+int supervisor_startstop_match(int rq, const char *patterns, int count)
+{
+	bool changed = false;
+	match_list_t m;
+	size_t i;
+	int ret;
+
+	memset(&m, 0, sizeof(m));
+
+	/* zero is what services start out with */
+	if (++match_gen == 0)
+		match_gen = 1;
+	m.gen = match_gen;
+
+	for (; count > 0; --count, patterns += strlen(patterns) + 1) {
+		if (collect_matches(&m, patterns))
 			break;
 	}
 
-	if (svc != NULL) {
-		/* TODO: something more sophisticated? */
-		svc->flags |= SVC_FLAG_ADMIN_STOPPED;
-		kill(svc->pid, SIGTERM);
+	for (i = 0; i < m.count; ++i) {
+		if (rq == EIR_START_MATCH) {
+			changed |= start_stopped(m.svcs[i]);
+		} else {
+			stop_running(m.svcs[i]);
+		}
 	}
+
+	if (changed)
+		rebuild_graph();
+
+	ret = m.count;
+	free(m.svcs);
+	return ret;
 }
@@ -0,0 +1,302 @@
+/* SPDX-License-Identifier: ISC */
+#include <sys/stat.h>
+#include <limits.h>
+
+#include "init.h"
+
+#define MOUNTINFO "/proc/self/mountinfo"
+#define OWNCGROUP "/proc/self/cgroup"
+
+/* cgroup of the init process, the service cgroups are created below it */
+static int base_fd = -1;
+static bool base_is_root = false;
+
+static int find_mount(char *path, size_t size)
+{
+	char line[1024], *root, *mnt, *type;
+	int ret = -1;
+	FILE *fp;
+
+	fp = fopen(MOUNTINFO, "re");
+	if (fp == NULL)
+		return -1;
+
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		/* ID, parent ID, device, root, mount point, ... - type */
+		strtok(line, " ");
+		strtok(NULL, " ");
+		strtok(NULL, " ");
+		root = strtok(NULL, " ");
+		mnt = strtok(NULL, " ");
+		type = strstr(mnt == NULL ? "" : mnt + strlen(mnt) + 1, " - ");
+
+		if (root == NULL || type == NULL || strcmp(root, "/") != 0)
+			continue;
+
+		if (strncmp(type + 3, "cgroup2 ", 8) != 0 || strlen(mnt) >= size)
+			continue;
+
+		strcpy(path, mnt);
+		ret = 0;
+		break;
+	}
+
+	fclose(fp);
+	return ret;
+}
+
+static int find_own_cgroup(char *path, size_t size)
+{
+	char line[PATH_MAX + 8];
+	int ret = -1;
+	size_t len;
+	FILE *fp;
+
+	fp = fopen(OWNCGROUP, "re");
+	if (fp == NULL)
+		return -1;
+
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (strncmp(line, "0::/", 4) != 0)
+			continue;
+
+		len = strcspn(line + 3, "\n");
+		if (len >= size)
+			break;
+
+		memcpy(path, line + 3, len);
+		path[len] = '\0';
+		ret = 0;
+		break;
+	}
+
+	fclose(fp);
+	return ret;
+}
+
+/*
+	The cgroup file system is usually mounted by a boot service, so this
+	is retried for every service that is started until it is there.
+*/
+static int open_base(void)
+{
+	char mnt[PATH_MAX], own[PATH_MAX], path[2 * PATH_MAX];
+
+	if (find_mount(mnt, sizeof(mnt)) || find_own_cgroup(own, sizeof(own)))
+		return -1;
+
+	snprintf(path, sizeof(path), "%s%s", mnt, own);
+	base_is_root = strcmp(own, "/") == 0;
+
+	base_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (base_fd < 0) {
+		perror(path);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int write_file(int dirfd, const char *name, const char *value)
+{
+	size_t len = strlen(value);
+	ssize_t ret;
+	int fd;
+
+	fd = openat(dirfd, name, O_WRONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	ret = write(fd, value, len);
+	close(fd);
+
+	return ret == (ssize_t)len ? 0 : -1;
+}
+
+/*
+	Processes are only allowed in the leaves of a cgroup with controllers
+	enabled for its children. The root cgroup is the exception, otherwise
+	init has to move into a leaf of its own first.
+*/
+static int enable_controller(const char *file)
+{
+	char value[32];
+	size_t len;
+	int dirfd;
+
+	len = strcspn(file, ".");
+	if (len + 2 > sizeof(value)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	value[0] = '+';
+	memcpy(value + 1, file, len);
+	value[len + 1] = '\0';
+
+	if (write_file(base_fd, "cgroup.subtree_control", value) == 0)
+		return 0;
+
+	if (errno != EBUSY || base_is_root)
+		return -1;
+
+	if (mkdirat(base_fd, "init.scope", 0755) != 0 && errno != EEXIST)
+		return -1;
+
+	dirfd = openat(base_fd, "init.scope", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dirfd < 0)
+		return -1;
+
+	if (write_file(dirfd, "cgroup.procs", "0")) {
+		close(dirfd);
+		return -1;
+	}
+
+	close(dirfd);
+	return write_file(base_fd, "cgroup.subtree_control", value);
+}
+
+/* a controller that cannot be enabled only costs the settings using it */
+static void apply_limits(service_t *svc)
+{
+	const char *file = svc->limits, *value;
+	int i;
+
+	for (i = 0; i < svc->num_limits; ++i) {
+		value = file + strlen(file) + 1;
+
+		if (enable_controller(file) ||
+		    write_file(svc->cgroup_fd, file, value)) {
+			fprintf(stderr, "%s: setting %s to '%s': %s\n",
+				svc->fname, file, value, strerror(errno));
+		}
+
+		file = value + strlen(value) + 1;
+	}
+}
+
+static int cgroup_name(const service_t *svc, char *name, size_t size)
+{
+	if ((size_t)snprintf(name, size, "%s.service", svc->fname) >= size) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	return 0;
+}
+
+/* returns 1 if there are processes in the cgroup, 0 if not, -1 on error */
+static int read_populated(int fd)
+{
+	char buffer[128], *ptr;
+	ssize_t ret;
+
+	/* reading the file also re-arms the notification */
+	ret = pread(fd, buffer, sizeof(buffer) - 1, 0);
+	if (ret < 0)
+		return -1;
+
+	buffer[ret] = '\0';
+
+	ptr = strstr(buffer, "populated ");
+	if (ptr == NULL)
+		return -1;
+
+	return ptr[10] == '1' ? 1 : 0;
+}
+
+static void handle_events(int fd, uint32_t events, void *arg)
+{
+	(void)events;
+
+	if (read_populated(fd) == 0)
+		supervisor_service_gone(arg);
+}
+
+int svccgroup_create(service_t *svc)
+{
+	char name[PATH_MAX];
+
+	if (svc->cgroup_fd >= 0)
+		return 0;
+
+	if (base_fd < 0 && open_base())
+		return -1;
+
+	if (cgroup_name(svc, name, sizeof(name)))
+		goto fail;
+
+	/* replace a left over one, unless there are still processes in it */
+	if (mkdirat(base_fd, name, 0755) != 0) {
+		if (errno != EEXIST)
+			goto fail;
+
+		if (unlinkat(base_fd, name, AT_REMOVEDIR) == 0 &&
+		    mkdirat(base_fd, name, 0755) != 0) {
+			goto fail;
+		}
+	}
+
+	svc->cgroup_fd = openat(base_fd, name,
+				O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (svc->cgroup_fd < 0)
+		goto fail;
+
+	svc->cgroup_events = openat(svc->cgroup_fd, "cgroup.events",
+				    O_RDONLY | O_CLOEXEC);
+	if (svc->cgroup_events < 0)
+		goto fail;
+
+	read_populated(svc->cgroup_events);
+	apply_limits(svc);
+
+	if (evloop_add(svc->cgroup_events, EPOLLPRI, handle_events, svc))
+		goto fail_close;
+
+	return 0;
+fail:
+	fprintf(stderr, "%s: creating cgroup: %s\n", svc->fname,
+		strerror(errno));
+fail_close:
+	if (svc->cgroup_events >= 0)
+		close(svc->cgroup_events);
+	if (svc->cgroup_fd >= 0)
+		close(svc->cgroup_fd);
+	svc->cgroup_events = -1;
+	svc->cgroup_fd = -1;
+	return -1;
+}
+
+void svccgroup_destroy(service_t *svc)
+{
+	char name[PATH_MAX];
+
+	if (svc->cgroup_fd < 0)
+		return;
+
+	evloop_remove(svc->cgroup_events);
+	close(svc->cgroup_events);
+	close(svc->cgroup_fd);
+	svc->cgroup_events = -1;
+	svc->cgroup_fd = -1;
+
+	/* fails if processes are left, the next run picks it up again */
+	if (cgroup_name(svc, name, sizeof(name)) == 0)
+		unlinkat(base_fd, name, AT_REMOVEDIR);
+}
+
+bool svccgroup_populated(service_t *svc)
+{
+	return svc->cgroup_events >= 0 && read_populated(svc->cgroup_events) > 0;
+}
+
+int svccgroup_kill(service_t *svc)
+{
+	if (svc->cgroup_fd < 0) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	/* available since Linux 5.14 */
+	return write_file(svc->cgroup_fd, "cgroup.kill", "1");
+}
@@ -0,0 +1,141 @@
+/* SPDX-License-Identifier: ISC */
+#include <time.h>
+
+#include "init.h"
+
+typedef struct {
+	ctlclient_t *conn;	/* connection, or NULL for datagram clients */
+	struct sockaddr_un addr;
+	socklen_t addrlen;
+} subscriber_t;
+
+static subscriber_t subscribers[INIT_MAX_SUBSCRIBERS];
+static int num_subscribers = 0;
+static int sockfd = -1;
+
+static int find_subscriber(const ctlclient_t *cl)
+{
+	int i;
+
+	for (i = 0; i < num_subscribers; ++i) {
+		if (cl->addrlen == 0) {
+			if (subscribers[i].conn == cl)
+				return i;
+			continue;
+		}
+
+		if (subscribers[i].conn == NULL &&
+		    subscribers[i].addrlen == cl->addrlen &&
+		    memcmp(&subscribers[i].addr, &cl->addr, cl->addrlen) == 0) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+static void drop_subscriber(int i)
+{
+	subscribers[i] = subscribers[--num_subscribers];
+}
+
+void svcevent_set_socket(int fd)
+{
+	int i;
+
+	sockfd = fd;
+
+	if (fd >= 0)
+		return;
+
+	for (i = 0; i < num_subscribers; ) {
+		if (subscribers[i].conn == NULL) {
+			drop_subscriber(i);
+		} else {
+			++i;
+		}
+	}
+}
+
+int svcevent_subscribe(ctlclient_t *cl)
+{
+	subscriber_t *sub;
+
+	if (cl->addrlen > 0 && cl->addrlen <= sizeof(sa_family_t))
+		return -1;
+
+	if (find_subscriber(cl) >= 0)
+		return 0;
+
+	if (num_subscribers == INIT_MAX_SUBSCRIBERS)
+		return -1;
+
+	sub = subscribers + num_subscribers;
+	memset(sub, 0, sizeof(*sub));
+
+	if (cl->addrlen == 0) {
+		sub->conn = cl;
+	} else {
+		memcpy(&sub->addr, &cl->addr, cl->addrlen);
+		sub->addrlen = cl->addrlen;
+	}
+
+	num_subscribers += 1;
+	return 0;
+}
+
+void svcevent_unsubscribe(const ctlclient_t *cl)
+{
+	int i = find_subscriber(cl);
+
+	if (i >= 0)
+		drop_subscriber(i);
+}
+
+void svcevent_notify(const service_t *svc, int old_state, int new_state)
+{
+	init_response_event_t ev;
+	struct timespec ts;
+	subscriber_t *sub;
+	ctlclient_t *cl;
+	int i, ret;
+
+	if (num_subscribers == 0)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	memset(&ev, 0, sizeof(ev));
+	ev.old_state = old_state;
+	ev.new_state = new_state;
+	ev.exit_status = svc->status & 0xFF;
+	ev.id = htobe32(svc->id);
+	ev.timestamp = htobe64((uint64_t)ts.tv_sec * 1000000000ULL +
+			       ts.tv_nsec);
+
+	for (i = 0; i < num_subscribers; ) {
+		sub = subscribers + i;
+
+		/* queued behind pending messages, subject to limits */
+		if (sub->conn != NULL) {
+			ret = ctlclient_send(sub->conn, &ev, sizeof(ev));
+		} else if (sockfd >= 0) {
+			cl = ctlclient_datagram(sockfd, &sub->addr,
+						sub->addrlen);
+			ret = cl == NULL ? -1 : ctlclient_send(cl, &ev,
+							       sizeof(ev));
+			if (cl != NULL)
+				ctlclient_release(cl);
+		} else {
+			ret = -1;
+		}
+
+		/* don't let a subscriber that is gone or stuck block us */
+		if (ret < 0) {
+			drop_subscriber(i);
+			continue;
+		}
+
+		++i;
+	}
+}
@@ -0,0 +1,51 @@
+/* SPDX-License-Identifier: ISC */
+#include <time.h>
+
+#include "init.h"
+
+/* number of events kept, the oldest ones are overwritten first */
+#define HISTORY_SIZE 2048
+
+static history_entry_t history[HISTORY_SIZE];
+static size_t first = 0;
+static size_t count = 0;
+
+void svchistory_add(const service_t *svc, int event, unsigned int index,
+		    int value)
+{
+	history_entry_t *ent;
+	struct timespec ts;
+
+	if (count == HISTORY_SIZE) {
+		ent = history + first;
+		first = (first + 1) % HISTORY_SIZE;
+	} else {
+		ent = history + (first + count) % HISTORY_SIZE;
+		count += 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	ent->timestamp = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	ent->id = svc->id;
+	ent->event = event;
+	ent->index = index > 0xFFFF ? 0xFFFF : index;
+	ent->value = value;
+}
+
+void svchistory_send(ctlclient_t *cl)
+{
+	status_writer_t w;
+	size_t i;
+
+	init_status_writer_init(&w, cl, INIT_HISTORY_VERSION);
+
+	for (i = 0; i < count; ++i) {
+		if (init_history_writer_add(&w, history +
+					    (first + i) % HISTORY_SIZE)) {
+			return;
+		}
+	}
+
+	init_status_writer_finish(&w);
+}
@@ -0,0 +1,203 @@
+/* SPDX-License-Identifier: ISC */
+#include <sys/inotify.h>
+#include <limits.h>
+
+#include "init.h"
+
+typedef struct {
+	service_t *svc;
+	int wd;
+} file_waiter_t;
+
+static int inotify_fd = -1;
+static file_waiter_t *waiters = NULL;
+static size_t num_waiters = 0;
+static size_t max_waiters = 0;
+
+static void handle_notify(int fd, uint32_t events, void *arg)
+{
+	char buffer[128];
+	bool ready = false;
+	ssize_t ret;
+	(void)events;
+
+	/* drain the pipe, so a chatty service cannot block on it */
+	for (;;) {
+		ret = read(fd, buffer, sizeof(buffer));
+
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			break;
+
+		ready = true;
+	}
+
+	if (ready)
+		supervisor_service_ready(arg);
+}
+
+static void remove_waiter(size_t i)
+{
+	int wd = waiters[i].wd;
+	size_t j;
+
+	waiters[i] = waiters[--num_waiters];
+
+	for (j = 0; j < num_waiters; ++j) {
+		if (waiters[j].wd == wd)
+			return;
+	}
+
+	inotify_rm_watch(inotify_fd, wd);
+}
+
+static void check_ready_files(void)
+{
+	service_t *svc;
+	size_t i = 0;
+
+	while (i < num_waiters) {
+		svc = waiters[i].svc;
+
+		if (access(svc->ready_file, F_OK) != 0) {
+			++i;
+			continue;
+		}
+
+		remove_waiter(i);
+		supervisor_service_ready(svc);
+	}
+}
+
+static void handle_inotify(int fd, uint32_t events, void *arg)
+{
+	char buffer[4096]
+		__attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t ret;
+	(void)events;
+	(void)arg;
+
+	for (;;) {
+		ret = read(fd, buffer, sizeof(buffer));
+
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			break;
+	}
+
+	check_ready_files();
+}
+
+static int watch_ready_file(service_t *svc)
+{
+	char dir[PATH_MAX];
+	file_waiter_t *new;
+	size_t len;
+	int wd;
+
+	if (inotify_fd < 0) {
+		inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (inotify_fd < 0) {
+			perror("inotify_init1");
+			return -1;
+		}
+
+		if (evloop_add(inotify_fd, EPOLLIN, handle_inotify, NULL)) {
+			close(inotify_fd);
+			inotify_fd = -1;
+			return -1;
+		}
+	}
+
+	/* the path is absolute, as checked when reading the service */
+	len = strrchr(svc->ready_file, '/') - svc->ready_file;
+	if (len >= sizeof(dir))
+		return -1;
+
+	if (len == 0) {
+		strcpy(dir, "/");
+	} else {
+		memcpy(dir, svc->ready_file, len);
+		dir[len] = '\0';
+	}
+
+	/* a left over file from a previous run says nothing */
+	if (unlink(svc->ready_file) != 0 && errno != ENOENT) {
+		perror(svc->ready_file);
+		return -1;
+	}
+
+	wd = inotify_add_watch(inotify_fd, dir,
+			       IN_CREATE | IN_MOVED_TO | IN_ONLYDIR);
+	if (wd < 0) {
+		perror(dir);
+		return -1;
+	}
+
+	if (num_waiters == max_waiters) {
+		max_waiters = max_waiters ? max_waiters * 2 : 8;
+		new = realloc(waiters, max_waiters * sizeof(new[0]));
+		if (new == NULL) {
+			perror("watching ready file");
+			max_waiters = num_waiters;
+			inotify_rm_watch(inotify_fd, wd);
+			return -1;
+		}
+		waiters = new;
+	}
+
+	waiters[num_waiters].svc = svc;
+	waiters[num_waiters].wd = wd;
+	num_waiters += 1;
+	return 0;
+}
+
+int svcready_start(service_t *svc)
+{
+	svc->flags &= ~SVC_FLAG_READY;
+
+	if (svc->flags & SVC_FLAG_READY_FILE)
+		return watch_ready_file(svc);
+
+	if (!(svc->flags & SVC_FLAG_READY_NOTIFY) || svc->notify_fd[0] >= 0)
+		return 0;
+
+	if (pipe2(svc->notify_fd, O_CLOEXEC)) {
+		perror("creating readiness pipe");
+		return -1;
+	}
+
+	/* only our end, the service may not expect EAGAIN */
+	fcntl(svc->notify_fd[0], F_SETFL, O_NONBLOCK);
+
+	if (evloop_add(svc->notify_fd[0], EPOLLIN, handle_notify, svc)) {
+		svcready_stop(svc);
+		return -1;
+	}
+
+	return 0;
+}
+
+void svcready_stop(service_t *svc)
+{
+	size_t i;
+
+	svc->flags &= ~SVC_FLAG_READY;
+
+	for (i = 0; i < num_waiters; ++i) {
+		if (waiters[i].svc == svc) {
+			remove_waiter(i);
+			break;
+		}
+	}
+
+	if (svc->notify_fd[0] >= 0) {
+		evloop_remove(svc->notify_fd[0]);
+		close(svc->notify_fd[0]);
+		close(svc->notify_fd[1]);
+		svc->notify_fd[0] = -1;
+		svc->notify_fd[1] = -1;
+	}
+}
@@ -0,0 +1,219 @@
+/* SPDX-License-Identifier: ISC */
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/stat.h>
+
+#include "init.h"
+
+static void handle_activity(int fd, uint32_t events, void *arg)
+{
+	(void)fd;
+	(void)events;
+
+	/* the service accepts the connection, we only wake it up */
+	svcsock_unwatch(arg);
+	supervisor_service_activated(arg);
+}
+
+/*
+	The socket file is given its owner and mode before the socket
+	listens, so no client can connect while it has the permissions
+	derived from the umask of init.
+*/
+static int open_unix(const char *path, const char *perm)
+{
+	unsigned long mode, uid, gid;
+	struct sockaddr_un addr;
+	char *end;
+	int fd;
+
+	mode = strtoul(perm, &end, 8);
+	uid = strtoul(end, &end, 10);
+	gid = strtoul(end, NULL, 10);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	strcpy(addr.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+
+	/* a socket left over from a previous run blocks the bind */
+	unlink(path);
+
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)))
+		goto fail;
+
+	if (chown(path, uid, gid) || chmod(path, mode) ||
+	    listen(fd, SOMAXCONN)) {
+		unlink(path);
+		goto fail;
+	}
+
+	return fd;
+fail:
+	close(fd);
+	return -1;
+}
+
+static int open_inet(int type, const char *port)
+{
+	struct sockaddr_in addr;
+	int fd, one = 1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(atoi(port));
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	fd = socket(AF_INET, type | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)))
+		goto fail;
+
+	if (type == SOCK_STREAM && listen(fd, SOMAXCONN))
+		goto fail;
+
+	return fd;
+fail:
+	close(fd);
+	return -1;
+}
+
+int svcsock_open(service_t *svc)
+{
+	const char *type, *addr, *perm;
+	int i;
+
+	if (svc->num_sockets == 0 || svc->listen_fds != NULL)
+		return 0;
+
+	svc->listen_fds = malloc(svc->num_sockets * sizeof(int));
+	if (svc->listen_fds == NULL) {
+		perror(svc->fname);
+		return -1;
+	}
+
+	for (i = 0; i < svc->num_sockets; ++i)
+		svc->listen_fds[i] = -1;
+
+	type = svc->sockets;
+
+	for (i = 0; i < svc->num_sockets; ++i) {
+		addr = type + strlen(type) + 1;
+		perm = addr + strlen(addr) + 1;
+
+		if (strcmp(type, "unix") == 0) {
+			svc->listen_fds[i] = open_unix(addr, perm);
+		} else if (strcmp(type, "tcp") == 0) {
+			svc->listen_fds[i] = open_inet(SOCK_STREAM, addr);
+		} else {
+			svc->listen_fds[i] = open_inet(SOCK_DGRAM, addr);
+		}
+
+		if (svc->listen_fds[i] < 0) {
+			fprintf(stderr, "%s: socket %s %s: %s\n", svc->fname,
+				type, addr, strerror(errno));
+			svcsock_close(svc);
+			return -1;
+		}
+
+		type = perm + strlen(perm) + 1;
+	}
+
+	return 0;
+}
+
+void svcsock_close(service_t *svc)
+{
+	const char *type, *addr;
+	int i;
+
+	if (svc->listen_fds == NULL)
+		return;
+
+	type = svc->sockets;
+
+	for (i = 0; i < svc->num_sockets; ++i) {
+		addr = type + strlen(type) + 1;
+
+		if (svc->listen_fds[i] >= 0) {
+			close(svc->listen_fds[i]);
+
+			if (strcmp(type, "unix") == 0)
+				unlink(addr);
+		}
+
+		type = addr + strlen(addr) + 1;
+		type += strlen(type) + 1;
+	}
+
+	free(svc->listen_fds);
+	svc->listen_fds = NULL;
+}
+
+void svcsock_take_over(service_t *svc, service_t *old)
+{
+	size_t len;
+	int i;
+
+	if (svc->num_sockets != old->num_sockets || old->listen_fds == NULL) {
+		svcsock_close(old);
+		svcsock_open(svc);
+		return;
+	}
+
+	for (i = 0, len = 0; i < 3 * svc->num_sockets; ++i)
+		len += strlen(svc->sockets + len) + 1;
+
+	if (memcmp(svc->sockets, old->sockets, len) != 0) {
+		svcsock_close(old);
+		svcsock_open(svc);
+		return;
+	}
+
+	/* same sockets, keep the ones clients may already be queued on */
+	svc->listen_fds = old->listen_fds;
+	old->listen_fds = NULL;
+}
+
+int svcsock_watch(service_t *svc)
+{
+	int i;
+
+	if (svc->listen_fds == NULL)
+		return -1;
+
+	for (i = 0; i < svc->num_sockets; ++i) {
+		if (evloop_add(svc->listen_fds[i], EPOLLIN,
+			       handle_activity, svc)) {
+			while (i-- > 0)
+				evloop_remove(svc->listen_fds[i]);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+void svcsock_unwatch(service_t *svc)
+{
+	int i;
+
+	if (svc->listen_fds == NULL)
+		return;
+
+	for (i = 0; i < svc->num_sockets; ++i)
+		evloop_remove(svc->listen_fds[i]);
+}
@@ -0,0 +1,175 @@
+/* SPDX-License-Identifier: ISC */
+#include <stdint.h>
+
+#include "init.h"
+
+static size_t hash_pid(pid_t pid)
+{
+	uint32_t x = (uint32_t)pid;
+
+	x = ((x >> 16) ^ x) * 0x45d9f3b;
+	x = ((x >> 16) ^ x) * 0x45d9f3b;
+	return (x >> 16) ^ x;
+}
+
+static size_t hash_string(const char *str)
+{
+	uint32_t hash = 2166136261;
+
+	while (*str != '\0') {
+		hash ^= (uint8_t)*(str++);
+		hash *= 16777619;
+	}
+
+	return hash;
+}
+
+static size_t hash_svc(const svc_table_t *tbl, const service_t *svc)
+{
+	if (tbl->type == SVC_TABLE_PID)
+		return hash_pid(svc->pid);
+
+	if (tbl->type == SVC_TABLE_NAME)
+		return hash_string(svc->name);
+
+	return hash_string(svc->fname);
+}
+
+static void insert_slot(svc_table_t *tbl, service_t *svc)
+{
+	size_t i = hash_svc(tbl, svc) & tbl->mask;
+
+	while (tbl->slots[i] != NULL)
+		i = (i + 1) & tbl->mask;
+
+	tbl->slots[i] = svc;
+}
+
+static int grow(svc_table_t *tbl)
+{
+	size_t i, size = tbl->slots == NULL ? 32 : (tbl->mask + 1) * 2;
+	service_t **old = tbl->slots;
+	size_t old_size = tbl->mask + 1;
+
+	tbl->slots = calloc(size, sizeof(tbl->slots[0]));
+	if (tbl->slots == NULL) {
+		tbl->slots = old;
+		return -1;
+	}
+
+	tbl->mask = size - 1;
+
+	if (old != NULL) {
+		for (i = 0; i < old_size; ++i) {
+			if (old[i] != NULL)
+				insert_slot(tbl, old[i]);
+		}
+	}
+
+	free(old);
+	return 0;
+}
+
+int svc_table_insert(svc_table_t *tbl, service_t *svc)
+{
+	if (tbl->slots == NULL || 2 * (tbl->count + 1) > tbl->mask + 1) {
+		if (grow(tbl)) {
+			perror("growing service table");
+			return -1;
+		}
+	}
+
+	insert_slot(tbl, svc);
+	tbl->count += 1;
+	return 0;
+}
+
+void svc_table_remove(svc_table_t *tbl, service_t *svc)
+{
+	size_t i, j, home;
+
+	if (tbl->slots == NULL)
+		return;
+
+	i = hash_svc(tbl, svc) & tbl->mask;
+
+	while (tbl->slots[i] != NULL && tbl->slots[i] != svc)
+		i = (i + 1) & tbl->mask;
+
+	if (tbl->slots[i] == NULL)
+		return;
+
+	tbl->slots[i] = NULL;
+	tbl->count -= 1;
+
+	/* shift back entries that were displaced past the freed slot */
+	for (j = (i + 1) & tbl->mask; tbl->slots[j] != NULL;
+	     j = (j + 1) & tbl->mask) {
+		home = hash_svc(tbl, tbl->slots[j]) & tbl->mask;
+
+		if (((j - home) & tbl->mask) >= ((j - i) & tbl->mask)) {
+			tbl->slots[i] = tbl->slots[j];
+			tbl->slots[j] = NULL;
+			i = j;
+		}
+	}
+}
+
+service_t *svc_table_find_pid(const svc_table_t *tbl, pid_t pid)
+{
+	size_t i;
+
+	if (tbl->slots == NULL)
+		return NULL;
+
+	for (i = hash_pid(pid) & tbl->mask; tbl->slots[i] != NULL;
+	     i = (i + 1) & tbl->mask) {
+		if (tbl->slots[i]->pid == pid)
+			return tbl->slots[i];
+	}
+
+	return NULL;
+}
+
+service_t *svc_table_find_fname(const svc_table_t *tbl, const char *fname)
+{
+	size_t i;
+
+	if (tbl->slots == NULL)
+		return NULL;
+
+	for (i = hash_string(fname) & tbl->mask; tbl->slots[i] != NULL;
+	     i = (i + 1) & tbl->mask) {
+		if (strcmp(tbl->slots[i]->fname, fname) == 0)
+			return tbl->slots[i];
+	}
+
+	return NULL;
+}
+
+service_t *svc_table_find_name(const svc_table_t *tbl, const char *name,
+			       size_t *pos)
+{
+	size_t i;
+
+	if (tbl->slots == NULL)
+		return NULL;
+
+	for (i = (hash_string(name) + *pos) & tbl->mask;
+	     tbl->slots[i] != NULL; i = (i + 1) & tbl->mask) {
+		*pos += 1;
+
+		if (strcmp(tbl->slots[i]->name, name) == 0)
+			return tbl->slots[i];
+	}
+
+	return NULL;
+}
+
+void svc_table_cleanup(svc_table_t *tbl)
+{
+	free(tbl->slots);
+	tbl->slots = NULL;
+	tbl->mask = 0;
+	tbl->count = 0;
+}
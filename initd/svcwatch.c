@@ -0,0 +1,282 @@
+/* SPDX-License-Identifier: ISC */
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <limits.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <ctype.h>
+
+#include "init.h"
+
+#define SVCDIR_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | \
+		       IN_MOVED_TO | IN_CLOSE_WRITE | IN_DONT_FOLLOW | \
+		       IN_ONLYDIR)
+
+#define TPLDIR_EVENTS (IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+		       IN_CLOSE_WRITE | IN_ONLYDIR)
+
+typedef struct {
+	int wd;
+	char *path;
+} tpl_watch_t;
+
+typedef struct {
+	char *name;
+	char *target;
+} svc_link_t;
+
+static int svcdir_fd = -1;
+static int svcdir_wd = -1;
+static tpl_watch_t *tpl_watches = NULL;
+static size_t num_tpl_watches = 0;
+static svc_link_t *links = NULL;
+static size_t num_links = 0;
+
+static bool is_service_name(const char *name)
+{
+	const char *ptr;
+
+	for (ptr = name; isalnum(*ptr) || *ptr == '_'; ++ptr)
+		;
+
+	return ptr != name && (*ptr == '\0' || *ptr == '@');
+}
+
+static const char *tpl_dir_by_wd(int wd)
+{
+	size_t i;
+
+	for (i = 0; i < num_tpl_watches; ++i) {
+		if (tpl_watches[i].wd == wd)
+			return tpl_watches[i].path;
+	}
+
+	return NULL;
+}
+
+static void watch_tpl_dir(int fd, const char *path)
+{
+	tpl_watch_t *new;
+	int wd;
+
+	wd = inotify_add_watch(fd, path, TPLDIR_EVENTS);
+	if (wd < 0 || wd == svcdir_wd || tpl_dir_by_wd(wd) != NULL)
+		return;
+
+	new = realloc(tpl_watches, sizeof(new[0]) * (num_tpl_watches + 1));
+	if (new == NULL)
+		goto fail;
+
+	tpl_watches = new;
+	tpl_watches[num_tpl_watches].wd = wd;
+	tpl_watches[num_tpl_watches].path = strdup(path);
+
+	if (tpl_watches[num_tpl_watches].path == NULL)
+		goto fail;
+
+	num_tpl_watches += 1;
+	return;
+fail:
+	perror("watching template directory");
+	inotify_rm_watch(fd, wd);
+}
+
+/* resolve the symlink into a canonical file path */
+static char *resolve_link(const char *name)
+{
+	char *path, *target;
+
+	if (asprintf(&path, "%s/%s", SVCDIR, name) < 0)
+		return NULL;
+
+	target = realpath(path, NULL);
+	free(path);
+	return target;
+}
+
+static void forget_link(const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < num_links; ++i) {
+		if (strcmp(links[i].name, name) == 0) {
+			free(links[i].name);
+			free(links[i].target);
+			links[i] = links[--num_links];
+			return;
+		}
+	}
+}
+
+/*
+	Remember where a service file symlink points to, so a change to a
+	template only reloads its instances, and watch the template
+	directory.
+*/
+static void track_link(int fd, const char *name)
+{
+	svc_link_t *new;
+	struct stat sb;
+	char *target, *slash;
+
+	forget_link(name);
+
+	if (fstatat(svcdir_fd, name, &sb, AT_SYMLINK_NOFOLLOW) ||
+	    (sb.st_mode & S_IFMT) != S_IFLNK) {
+		return;
+	}
+
+	target = resolve_link(name);
+	if (target == NULL)
+		return;
+
+	new = realloc(links, sizeof(new[0]) * (num_links + 1));
+	if (new == NULL)
+		goto fail;
+
+	links = new;
+	links[num_links].target = target;
+	links[num_links].name = strdup(name);
+
+	if (links[num_links].name == NULL)
+		goto fail;
+
+	num_links += 1;
+
+	slash = strrchr(target, '/');
+	if (slash != NULL && slash != target) {
+		*slash = '\0';
+		watch_tpl_dir(fd, target);
+		*slash = '/';
+	}
+	return;
+fail:
+	perror("tracking service file symlink");
+	free(target);
+}
+
+/*
+	A template file was modified or removed. Reload all service files
+	that are symlinks pointing to it.
+*/
+static void template_changed(const char *dir, const char *name)
+{
+	size_t i, len = strlen(dir);
+
+	for (i = 0; i < num_links; ++i) {
+		if (strncmp(links[i].target, dir, len) == 0 &&
+		    links[i].target[len] == '/' &&
+		    strcmp(links[i].target + len + 1, name) == 0) {
+			supervisor_reload_service(svcdir_fd, links[i].name);
+		}
+	}
+}
+
+int svcwatch_init(void)
+{
+	struct dirent *ent;
+	DIR *dp;
+	int fd;
+
+	svcdir_fd = open(SVCDIR, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (svcdir_fd < 0) {
+		perror(SVCDIR);
+		return -1;
+	}
+
+	fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd < 0) {
+		perror("inotify_init1");
+		goto fail;
+	}
+
+	svcdir_wd = inotify_add_watch(fd, SVCDIR, SVCDIR_EVENTS);
+	if (svcdir_wd < 0) {
+		perror("inotify_add_watch: " SVCDIR);
+		goto fail;
+	}
+
+	watch_tpl_dir(fd, TEMPLATEDIR);
+
+	dp = opendir(SVCDIR);
+	if (dp != NULL) {
+		while ((ent = readdir(dp)) != NULL) {
+			if (is_service_name(ent->d_name))
+				track_link(fd, ent->d_name);
+		}
+		closedir(dp);
+	}
+
+	return fd;
+fail:
+	if (fd >= 0)
+		close(fd);
+	close(svcdir_fd);
+	svcdir_fd = -1;
+	return -1;
+}
+
+void svcwatch_handle(int fd)
+{
+	char buffer[4096]
+		__attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *ev, *prev;
+	const char *dir;
+	struct stat sb;
+	ssize_t ret;
+	char *ptr;
+
+	for (;;) {
+		ret = read(fd, buffer, sizeof(buffer));
+
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			break;
+
+		for (ptr = buffer, prev = NULL; ptr < buffer + ret;
+		     ptr += sizeof(*ev) + ev->len) {
+			ev = (const struct inotify_event *)ptr;
+
+			if (ev->mask & IN_Q_OVERFLOW) {
+				supervisor_reload_config();
+				continue;
+			}
+
+			if (ev->len == 0)
+				continue;
+
+			/* skip repeated events for the same, reloaded file */
+			if (prev != NULL && prev->wd == ev->wd &&
+			    strcmp(prev->name, ev->name) == 0) {
+				continue;
+			}
+
+			if (ev->wd != svcdir_wd) {
+				dir = tpl_dir_by_wd(ev->wd);
+				if (dir != NULL)
+					template_changed(dir, ev->name);
+				prev = ev;
+				continue;
+			}
+
+			if (!is_service_name(ev->name))
+				continue;
+
+			/* wait for regular files to be written completely */
+			if (ev->mask & IN_CREATE) {
+				if (fstatat(svcdir_fd, ev->name, &sb,
+					    AT_SYMLINK_NOFOLLOW) ||
+				    (sb.st_mode & S_IFMT) != S_IFLNK) {
+					continue;
+				}
+			}
+
+			if (!(ev->mask & IN_CLOSE_WRITE))
+				track_link(fd, ev->name);
+
+			supervisor_reload_service(svcdir_fd, ev->name);
+			prev = ev;
+		}
+	}
+}
@@ -2,25 +2,71 @@
 #ifndef INITSOCK_H
 #define INITSOCK_H
 
+#include <stdbool.h>
 #include <stdint.h>
+#include <stddef.h>
 
 #include "config.h"
 #include "service.h"
 
 #define INIT_SOCK_PATH SOCKDIR "/init.sock"
 
+/*
+	Name of the connection oriented (SOCK_SEQPACKET) control socket in the
+	abstract namespace, without the leading null byte.
+*/
+#define INIT_SOCK_ABSTRACT "init.ctl"
+
+/* maximum number of simultaneous connections to the SOCK_SEQPACKET socket */
+#define INIT_MAX_CLIENTS 16
+
+/* version of the batched status reply format */
+#define INIT_STATUS_VERSION 3
+
+/* version of the timeline reply format */
+#define INIT_TIMELINE_VERSION 1
+
+/* version of the history reply format */
+#define INIT_HISTORY_VERSION 1
+
+/*
+	Seconds a client waits for the first datagram of a batched status
+	reply on the datagram socket, before assuming that init is too old
+	to know EIR_STATUS_BATCH and falling back to EIR_STATUS.
+*/
+#define INIT_STATUS_BATCH_TIMEOUT 2
+
+/* maximum size of a single batched status datagram */
+#define INIT_STATUS_BATCH_MAX 16384
+
+/* maximum size of a request datagram, including appended patterns */
+#define INIT_REQUEST_MAX 4096
+
 typedef enum {
 	EIR_STATUS = 0x00,
 	EIR_START = 0x01,
 	EIR_STOP = 0x02,
+	EIR_STATUS_BATCH = 0x03,
+	EIR_START_MATCH = 0x04,
+	EIR_STOP_MATCH = 0x05,
+	EIR_SUBSCRIBE = 0x06,
+	EIR_UNSUBSCRIBE = 0x07,
+	EIR_TIMELINE = 0x08,
+	EIR_HISTORY = 0x09,
 } E_INIT_REQUEST;
 
+/* maximum number of clients subscribed to service state changes */
+#define INIT_MAX_SUBSCRIBERS 16
+
 typedef enum {
 	ESS_NONE = 0x00,
 	ESS_RUNNING = 0x01,
 	ESS_ENQUEUED = 0x02,
 	ESS_DONE = 0x03,
-	ESS_FAILED = 0x04
+	ESS_FAILED = 0x04,
+	ESS_BACKOFF = 0x05,	/* waiting to be respawned */
+	ESS_READY = 0x06,	/* running and reported readiness */
+	ESS_IDLE = 0x07,	/* lazy, waiting for a client to start it */
 } E_SERVICE_STATE;
 
 typedef struct {
@@ -30,15 +76,31 @@ typedef struct {
 	union {
 		struct {
 			uint8_t filter;
-			uint8_t padd[3];
+			uint8_t version;	/* only for EIR_STATUS_BATCH */
+			uint8_t padd[2];
 		} status;
 
 		struct {
 			uint32_t id;
 		} startstop;
+
+		/*
+			For EIR_START_MATCH and EIR_STOP_MATCH, the request
+			is followed by count null-terminated glob patterns
+			that take up size bytes in total.
+		*/
+		struct {
+			uint16_t count;
+			uint16_t size;
+		} match;
 	} arg;
 } init_request_t;
 
+/* reply to EIR_START_MATCH and EIR_STOP_MATCH */
+typedef struct {
+	uint32_t count;		/* number of matching services */
+} init_response_match_t;
+
 typedef struct {
 	uint8_t state;
 	uint8_t exit_status;
@@ -46,15 +108,167 @@ typedef struct {
 	int32_t id;
 } init_response_status_t;
 
+/*
+	Reply to an EIR_STATUS_BATCH request. Each datagram starts with this
+	header, followed by count records. The last datagram of a reply has
+	the ISB_FLAG_LAST flag set and may contain no records at all.
+*/
+typedef struct {
+	uint8_t version;
+	uint8_t flags;
+	uint16_t count;
+} init_status_batch_t;
+
+#define ISB_FLAG_LAST 0x01
+
+/*
+	A single service in a batched status reply. The record is followed by
+	the null-terminated file name and service name, and padded with
+	zero bytes to a multiple of 4. All multi byte fields are big endian.
+*/
+typedef struct {
+	uint8_t state;
+	uint8_t exit_status;
+	uint16_t fname_len;	/* excluding the null-terminator */
+	int32_t id;
+	uint16_t name_len;	/* excluding the null-terminator */
+	uint16_t respawns;	/* number of times the service was respawned */
+	uint32_t backoff;	/* milliseconds until the next respawn */
+	uint8_t signal;		/* signal that killed the last process or 0 */
+	uint8_t flags;		/* ISR_FLAG_* */
+	uint8_t padd[2];
+	uint64_t run_time;	/* duration of the latest run in milliseconds */
+
+	/* resource usage of the latest and of all runs, see svc_usage_t */
+	uint64_t usage[5];
+	uint64_t total_usage[5];
+} init_status_record_t;
+
+#define ISR_FLAG_CORE_DUMPED 0x01
+
+/*
+	Earlier versions of the format use a prefix of the record: version 1
+	ends before backoff, with respawns being zero padding, version 2 ends
+	before signal. Version 1 only knows the states up to ESS_FAILED,
+	version 2 also ESS_BACKOFF.
+*/
+#define INIT_STATUS_RECORD_V1 offsetof(init_status_record_t, backoff)
+#define INIT_STATUS_RECORD_V2 offsetof(init_status_record_t, signal)
+
+/*
+	A single service in a reply to EIR_TIMELINE, which is batched the
+	same way as a status reply, with version INIT_TIMELINE_VERSION. The
+	record is followed by the null-terminated file name and service name
+	and padded with zero bytes to a multiple of 4. The time stamps are
+	indexed by SVC_TS_*, in nanoseconds, zero if the service did not get
+	there. All multi byte fields are big endian.
+*/
+typedef struct {
+	uint8_t state;
+	uint8_t type;
+	uint8_t target;
+	uint8_t padd;
+	int32_t id;
+	uint16_t fname_len;	/* excluding the null-terminator */
+	uint16_t name_len;	/* excluding the null-terminator */
+	uint8_t padd2[4];
+	uint64_t mono[SVC_TS_MAX];	/* CLOCK_MONOTONIC */
+	uint64_t boot[SVC_TS_MAX];	/* CLOCK_BOOTTIME */
+} init_timeline_record_t;
+
+typedef struct {
+	E_SERVICE_STATE state;
+	int type;
+	int target;
+	int id;
+	const char *filename;
+	const char *service_name;
+	uint64_t mono[SVC_TS_MAX];
+	uint64_t boot[SVC_TS_MAX];
+} init_timeline_t;
+
+/* supervision events recorded in the history of init */
+typedef enum {
+	EHE_ENQUEUED = 0x00,	/* waiting for dependencies */
+	EHE_EXEC_START = 0x01,	/* index is the command of the exec block */
+	EHE_EXEC_END = 0x02,	/* value is the exit status of the command */
+	EHE_READY = 0x03,
+	EHE_BACKOFF = 0x04,	/* value is the respawn delay in ms */
+	EHE_STOP = 0x05,	/* stop requested by the admin */
+	EHE_IDLE = 0x06,	/* lazy service waiting for a client */
+	EHE_EXITED = 0x07,	/* value is the exit status of the service */
+} E_HISTORY_EVENT;
+
+/*
+	A single event in a reply to EIR_HISTORY, which is batched the same
+	way as a status reply, with version INIT_HISTORY_VERSION, oldest
+	event first. The time stamp is taken from CLOCK_MONOTONIC, in
+	nanoseconds. All multi byte fields are big endian.
+*/
+typedef struct {
+	uint64_t timestamp;
+	int32_t id;
+	uint8_t event;
+	uint8_t padd;
+	uint16_t index;
+	int32_t value;
+	uint8_t padd2[4];
+} init_history_record_t;
+
+typedef struct {
+	uint64_t timestamp;
+	int id;
+	E_HISTORY_EVENT event;
+	unsigned int index;
+	int value;
+} init_history_t;
+
 typedef struct {
 	E_SERVICE_STATE state;
 	int exit_status;
 	int id;
 	char *filename;
 	char *service_name;
+
+	/* only set by init_socket_read_status */
+	unsigned int respawns;
+	unsigned int backoff;
+	int signal;
+	bool core_dumped;
+	uint64_t run_time;
+	svc_usage_t usage;
+	svc_usage_t total_usage;
 } init_status_t;
 
-int init_socket_open(const char *tmppath);
+/*
+	Sent to all subscribed clients whenever a service changes its state.
+	The time stamp is taken from CLOCK_MONOTONIC, in nanoseconds. All
+	multi byte fields are big endian.
+*/
+typedef struct {
+	uint8_t old_state;
+	uint8_t new_state;
+	uint8_t exit_status;
+	uint8_t padd;
+	int32_t id;
+	uint64_t timestamp;
+} init_response_event_t;
+
+typedef struct {
+	E_SERVICE_STATE old_state;
+	E_SERVICE_STATE new_state;
+	int exit_status;
+	int id;
+	uint64_t timestamp;
+} init_event_t;
+
+/*
+	Open a socket for talking to init. This connects to the SOCK_SEQPACKET
+	control socket if possible. If init does not provide one, a datagram
+	socket bound to an automatically assigned abstract address is
+	connected to INIT_SOCK_PATH instead.
+*/
+int init_socket_open(void);
 
 int init_socket_send_request(int fd, E_INIT_REQUEST rq, ...);
 
@@ -62,4 +276,101 @@ int init_socket_recv_status(int fd, init_status_t *resp);
 
 void free_init_status(init_status_t *resp);
 
+/*
+	Receive the next service state change event, after subscribing
+	with an EIR_SUBSCRIBE request. Returns 0 on success, -1 on failure.
+	Unlike the other functions, this fails with EINTR if the wait for an
+	event is interrupted by a signal.
+*/
+int init_socket_recv_event(int fd, init_event_t *ev);
+
+/*
+	Ask init to start or stop (rq is EIR_START_MATCH or EIR_STOP_MATCH)
+	all services whose file name or service name match one of the shell
+	glob patterns. If the patterns do not fit into a single request,
+	multiple requests are sent.
+
+	Returns the total number of matching services, or -1 on failure.
+*/
+int init_socket_request_match(int fd, E_INIT_REQUEST rq,
+			      char *const patterns[], int count);
+
+/* state for decoding a batched status or timeline reply */
+typedef struct {
+	uint8_t buffer[INIT_STATUS_BATCH_MAX];
+	size_t size;
+	size_t offset;
+	unsigned int count;	/* records left in the current datagram */
+	bool last;
+	/*
+		Newest reply format version the client understands. Lowered
+		to the version of the first datagram of the reply.
+	*/
+	uint8_t version;
+
+	/* set if the reply may be the unbatched one of an older init */
+	bool fallback;
+	bool legacy;
+	uint8_t filter;
+} init_status_reader_t;
+
+/*
+	Send an EIR_STATUS_BATCH request and prepare the reader for decoding
+	the reply. On the datagram socket, init_socket_read_status falls back
+	to an EIR_STATUS request if no reply arrives within
+	INIT_STATUS_BATCH_TIMEOUT seconds. Returns 0 on success, -1 on
+	failure.
+*/
+int init_socket_request_status(int fd, init_status_reader_t *rd,
+			       E_SERVICE_STATE filter);
+
+/*
+	Decode the next service from a batched status reply, receiving more
+	datagrams as needed. This does not allocate any memory: the strings
+	in resp point into the reader buffer and are only valid until the
+	next call, so resp must not be passed to free_init_status.
+
+	Returns 1 if a service was decoded, 0 at the end of the reply and -1
+	on failure.
+*/
+int init_socket_read_status(int fd, init_status_reader_t *rd,
+			    init_status_t *resp);
+
+/*
+	Receive the next datagram of a batched reply into the reader buffer.
+	Returns 0 on success, -1 on failure.
+*/
+int init_socket_recv_batch(int fd, init_status_reader_t *rd);
+
+/*
+	Send an EIR_TIMELINE request and prepare the reader for decoding the
+	reply. Returns 0 on success, -1 on failure.
+*/
+int init_socket_request_timeline(int fd, init_status_reader_t *rd);
+
+/*
+	Decode the next service from a timeline reply, the same way as
+	init_socket_read_status does for a status reply.
+
+	Returns 1 if a service was decoded, 0 at the end of the reply and -1
+	on failure.
+*/
+int init_socket_read_timeline(int fd, init_status_reader_t *rd,
+			      init_timeline_t *out);
+
+/*
+	Send an EIR_HISTORY request and prepare the reader for decoding the
+	reply. Returns 0 on success, -1 on failure.
+*/
+int init_socket_request_history(int fd, init_status_reader_t *rd);
+
+/*
+	Decode the next event from a history reply.
+
+	Returns 1 if an event was decoded, 0 at the end of the reply and -1
+	on failure.
+*/
+int init_socket_read_history(int fd, init_status_reader_t *rd,
+			     init_history_t *out);
+
 #endif /* INITSOCK_H */
@@ -3,10 +3,23 @@
 #define SERVICE_H
 
 #include <sys/types.h>
+#include <stdint.h>
+#include <time.h>
 
 typedef struct exec_t {
 	struct exec_t *next;
 	int argc;		/* number of elements in argument vector */
+
+	/* set up by init when the command is first executed */
+	char **argv;		/* pointers into args, NULL terminated */
+	char *path;		/* resolved executable or NULL */
+	unsigned int path_gen;	/* environment the path was resolved in */
+
+	/* outcome of the last run of this command, recorded by init */
+	int status;		/* exit status */
+	struct timespec started;	/* CLOCK_MONOTONIC */
+	struct timespec exited;
+
 	char args[];		/* argument vectot string blob */
 } exec_t;
 
@@ -39,25 +52,118 @@ enum {
 	/* truncate stdout */
 	SVC_FLAG_TRUNCATE_OUT = 0x01,
 
+	/* the service reports readiness through a notification pipe */
+	SVC_FLAG_READY_NOTIFY = 0x02,
+
+	/* the service is ready once ready_file exists */
+	SVC_FLAG_READY_FILE = 0x04,
+
+	/* only start the service once a client uses one of its sockets */
+	SVC_FLAG_LAZY = 0x08,
+
 	SVC_FLAG_HAS_EXEC = 0x10,
 	SVC_FLAG_ADMIN_STOPPED = 0x20,
+
+	/* runtime state maintained by initd */
+	SVC_FLAG_READY = 0x40,
+	SVC_FLAG_WAIT_READY = 0x80,	/* dependents wait for readiness */
+	SVC_FLAG_ACTIVATED = 0x100,	/* a client is waiting on a lazy service */
+	SVC_FLAG_CORE_DUMPED = 0x200,	/* the last process dumped core */
+	SVC_FLAG_STOPPING = 0x400,	/* waiting for the cgroup to empty */
 };
 
+#define SVC_FLAG_RUNTIME (SVC_FLAG_ADMIN_STOPPED | SVC_FLAG_READY | \
+			  SVC_FLAG_WAIT_READY | SVC_FLAG_ACTIVATED | \
+			  SVC_FLAG_CORE_DUMPED | SVC_FLAG_STOPPING)
+
+/* resources used by service processes, as reported by the kernel */
+typedef struct {
+	uint64_t utime;		/* user CPU time in microseconds */
+	uint64_t stime;		/* system CPU time in microseconds */
+	uint64_t maxrss;	/* peak resident set size in KiB */
+	uint64_t minflt;	/* page faults served without I/O */
+	uint64_t majflt;	/* page faults that required I/O */
+} svc_usage_t;
+
+/* transitions of a service that initd records the time of */
+enum {
+	SVC_TS_ENQUEUED = 0,	/* put on the queue to be started */
+	SVC_TS_FORKED,		/* process of the first command created */
+	SVC_TS_EXECED,		/* first command running */
+	SVC_TS_READY,		/* dependents were released */
+	SVC_TS_EXITED,		/* last process exited */
+
+	SVC_TS_MAX
+};
+
+/* maximum number of listening sockets per service */
+#define SVC_MAX_SOCKETS 16
+
+/* default respawn delay bounds in milliseconds */
+#define SVC_BACKOFF_MIN_DEFAULT 100
+#define SVC_BACKOFF_MAX_DEFAULT 30000
+
+/* default time in seconds a service may take to report readiness */
+#define SVC_READY_TIMEOUT_DEFAULT 90
+
 typedef struct service_t {
 	struct service_t *next;
 
+	/* back links used by initd to unlink a service in constant time */
+	struct service_t **pprev;
+	struct service_t **list;	/* head of the list it is on */
+
 	char *fname;		/* source file name */
 
 	int type;		/* SVC_* service type */
 	int target;		/* TGT_* service target */
 	char *desc;		/* description string */
 	char *ctty;		/* controlling tty or log file */
+	char *ready_file;	/* file created by the service once ready */
 	int rspwn_limit;	/* maximum respawn count */
 	int rspwn_count;	/* services respawn counter */
 	unsigned int flags;	/* SVC_FLAG_* bit field */
 
+	/*
+		Respawn delay bounds in milliseconds. The delay starts at
+		backoff_min and doubles with every crash, up to backoff_max.
+	*/
+	unsigned int backoff_min;
+	unsigned int backoff_max;
+
+	/* at most window_count respawns within window_time seconds */
+	unsigned int window_count;
+	unsigned int window_time;
+
+	/* seconds until dependents stop waiting for readiness, 0 for never */
+	unsigned int ready_timeout;
+
+	/* respawn state maintained by initd */
+	unsigned int backoff;		/* current delay in milliseconds */
+	struct timespec respawn_at;	/* when to respawn, CLOCK_MONOTONIC */
+	struct timespec window_start;
+	unsigned int window_respawns;
+
+	/* when dependents stop waiting for readiness, CLOCK_MONOTONIC */
+	struct timespec ready_deadline;
+
+	/*
+		Time stamps of the latest run in nanoseconds, taken from
+		CLOCK_MONOTONIC and CLOCK_BOOTTIME, indexed by SVC_TS_*.
+		Zero if the service did not get there (yet).
+	*/
+	uint64_t ts_mono[SVC_TS_MAX];
+	uint64_t ts_boot[SVC_TS_MAX];
+
+	/* termination and resource usage, recorded by initd */
+	int term_signal;	/* signal that killed the last process, or 0 */
+	uint64_t run_time;	/* duration of the latest run in milliseconds */
+	svc_usage_t usage;	/* all processes of the latest run */
+	svc_usage_t total_usage;	/* all runs, maxrss is the peak of all */
+
 	/* linked list of command lines to execute */
 	exec_t *exec;
+	exec_t *current;	/* command last started by initd */
 
 	char *before;	/* services that must be executed later */
 	char *after;	/* services that must be executed first */
@@ -65,9 +171,38 @@ typedef struct service_t {
 	int num_before;
 	int num_after;
 
+	/*
+		Listening sockets created by initd and passed to the service,
+		as triples of type ("unix", "tcp" or "udp"), address and, for
+		unix sockets, the octal mode, uid and gid of the socket file
+		separated by spaces (empty for the others).
+	*/
+	char *sockets;
+	int num_sockets;
+	int *listen_fds;	/* opened by initd, num_sockets entries */
+
+	/*
+		Resource controls written to the cgroup of the service when
+		initd creates it, as pairs of cgroup file and value.
+	*/
+	char *limits;
+	int num_limits;
+
 	pid_t pid;
+	int pidfd;		/* pidfd of the running process or -1 */
+	int notify_fd[2];	/* readiness notification pipe or -1 */
+	int cgroup_fd;		/* cgroup directory of the service or -1 */
+	int cgroup_events;	/* its cgroup.events file or -1 */
 	int status;		/* process exit status */
 	int id;			/* service ID used by initd */
+	int state;		/* state last reported to subscribers */
+	unsigned int match_gen;	/* last start/stop request that matched it */
+
+	/* dependency graph state maintained by initd while scheduling */
+	struct service_t **dependents;	/* services waiting for this one */
+	int num_dependents;
+	int pending;		/* number of unsatisfied dependencies */
+	int queue_pos;		/* position on the queue */
 
 	char name[];		/* canonical service name */
 } service_t;
@@ -89,9 +224,30 @@ void delsvc(service_t *svc);
 
 	Returns 0 on success, -1 on failure. The function takes care of
 	printing error messages on failure.
+
+	A compiled snapshot of the result is kept in a cache file. As long
+	as none of the service files (or the templates they link to) have
+	changed, the snapshot is loaded instead of parsing the files.
 */
 int svcscan(const char *directory, service_list_t *list);
 
+/*
+	Load a service list from a snapshot written by svc_cache_store if
+	the key stored in it matches.
+
+	Returns 0 on success, -1 if the file is missing, stale or broken.
+*/
+int svc_cache_load(const char *path, uint64_t key, service_list_t *list);
+
+/*
+	Atomically replace the snapshot file with the given, sorted service
+	list. This is done on a best effort basis.
+
+	Returns 0 on success, -1 on failure.
+*/
+int svc_cache_store(const char *path, uint64_t key,
+		    const service_list_t *list);
+
 void del_svc_list(service_list_t *list);
 
 /*
@@ -14,6 +14,8 @@ void delsvc(service_t *svc)
 		e = svc->exec;
 		svc->exec = e->next;
 
+		free(e->argv);
+		free(e->path);
 		free(e);
 	}
 
@@ -23,5 +25,10 @@ void delsvc(service_t *svc)
 	free(svc->desc);
 	free(svc->exec);
 	free(svc->ctty);
+	free(svc->ready_file);
+	free(svc->sockets);
+	free(svc->limits);
+	free(svc->listen_fds);
+	free(svc->dependents);
 	free(svc);
 }
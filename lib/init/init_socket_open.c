@@ -1,39 +1,81 @@
 /* SPDX-License-Identifier: ISC */
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <string.h>
-#include <errno.h>
 #include <stdio.h>
 
 #include "initsock.h"
 
-int init_socket_open(const char *tmppath)
+/*
+	Any process can bind an abstract socket name, so the one listening
+	on it must also be the init process running as root.
+*/
+static bool is_init(int fd)
+{
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len))
+		return false;
+
+	return cred.pid == 1 && cred.uid == 0;
+}
+
+static int connect_abstract(void)
 {
 	struct sockaddr_un un;
+	socklen_t len;
 	int fd;
 
-	fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
-	if (fd < 0) {
-		perror("socket");
+	fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (fd < 0)
 		return -1;
-	}
 
 	memset(&un, 0, sizeof(un));
 	un.sun_family = AF_UNIX;
+	memcpy(un.sun_path + 1, INIT_SOCK_ABSTRACT,
+	       sizeof(INIT_SOCK_ABSTRACT) - 1);
 
-	strcpy(un.sun_path, tmppath);
+	len = offsetof(struct sockaddr_un, sun_path) +
+	      sizeof(INIT_SOCK_ABSTRACT);
 
-	if (bind(fd, (struct sockaddr *)&un, sizeof(un))) {
-		fprintf(stderr, "bind: %s: %s", tmppath, strerror(errno));
+	if (connect(fd, (struct sockaddr *)&un, len) || !is_init(fd)) {
 		close(fd);
-		unlink(tmppath);
+		return -1;
+	}
+
+	return fd;
+}
+
+/*
+	An older init only has the datagram socket and sends replies to the
+	address a request came from. Binding to an automatically assigned
+	abstract address gives the client one without a file that has to be
+	cleaned up.
+*/
+static int connect_datagram(void)
+{
+	struct sockaddr_un un;
+	int fd;
+
+	fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		perror("socket");
 		return -1;
 	}
 
 	memset(&un, 0, sizeof(un));
 	un.sun_family = AF_UNIX;
 
+	if (bind(fd, (struct sockaddr *)&un, sizeof(sa_family_t))) {
+		perror("bind");
+		close(fd);
+		return -1;
+	}
+
 	strcpy(un.sun_path, INIT_SOCK_PATH);
 
 	if (connect(fd, (struct sockaddr *)&un, sizeof(un))) {
@@ -44,3 +86,10 @@ int init_socket_open(const char *tmppath)
 
 	return fd;
 }
+
+int init_socket_open(void)
+{
+	int fd = connect_abstract();
+
+	return fd >= 0 ? fd : connect_datagram();
+}
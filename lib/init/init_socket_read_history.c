@@ -0,0 +1,50 @@
+/* SPDX-License-Identifier: ISC */
+#include <stdint.h>
+#include <string.h>
+#include <endian.h>
+#include <errno.h>
+
+#include "initsock.h"
+
+int init_socket_request_history(int fd, init_status_reader_t *rd)
+{
+	rd->size = 0;
+	rd->offset = 0;
+	rd->count = 0;
+	rd->last = false;
+	rd->version = INIT_HISTORY_VERSION;
+
+	return init_socket_send_request(fd, EIR_HISTORY);
+}
+
+int init_socket_read_history(int fd, init_status_reader_t *rd,
+			     init_history_t *out)
+{
+	init_history_record_t rec;
+
+	memset(out, 0, sizeof(*out));
+
+	while (rd->count == 0) {
+		if (rd->last)
+			return 0;
+		if (init_socket_recv_batch(fd, rd))
+			return -1;
+	}
+
+	if (rd->size - rd->offset < sizeof(rec)) {
+		errno = EPROTO;
+		return -1;
+	}
+
+	memcpy(&rec, rd->buffer + rd->offset, sizeof(rec));
+
+	out->timestamp = be64toh(rec.timestamp);
+	out->id = (int32_t)be32toh(rec.id);
+	out->event = rec.event;
+	out->index = be16toh(rec.index);
+	out->value = (int32_t)be32toh(rec.value);
+
+	rd->offset += sizeof(rec);
+	rd->count -= 1;
+	return 1;
+}
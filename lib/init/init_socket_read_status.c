@@ -0,0 +1,226 @@
+/* SPDX-License-Identifier: ISC */
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <endian.h>
+#include <errno.h>
+
+#include "initsock.h"
+
+static int set_timeout(int fd, int seconds)
+{
+	struct timeval tv;
+
+	memset(&tv, 0, sizeof(tv));
+	tv.tv_sec = seconds;
+
+	return setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+}
+
+int init_socket_request_status(int fd, init_status_reader_t *rd,
+			       E_SERVICE_STATE filter)
+{
+	socklen_t len = sizeof(int);
+	int type;
+
+	rd->size = 0;
+	rd->offset = 0;
+	rd->count = 0;
+	rd->last = false;
+	rd->version = INIT_STATUS_VERSION;
+	rd->legacy = false;
+	rd->filter = filter;
+
+	/*
+		An init that only provides the datagram socket may be one that
+		silently drops EIR_STATUS_BATCH requests.
+	*/
+	rd->fallback = getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) == 0 &&
+		       type == SOCK_DGRAM &&
+		       set_timeout(fd, INIT_STATUS_BATCH_TIMEOUT) == 0;
+
+	return init_socket_send_request(fd, EIR_STATUS_BATCH, filter);
+}
+
+/*
+	Receive a service from an unbatched EIR_STATUS reply and copy the
+	strings into the reader buffer, so the caller does not need to
+	treat the two reply formats differently.
+*/
+static int read_legacy(int fd, init_status_reader_t *rd,
+		       init_status_t *resp)
+{
+	size_t flen, nlen;
+	init_status_t st;
+
+	if (init_socket_recv_status(fd, &st)) {
+		free_init_status(&st);
+		return -1;
+	}
+
+	if (st.state == ESS_NONE) {
+		rd->last = true;
+		return set_timeout(fd, 0);
+	}
+
+	flen = strlen(st.filename);
+	nlen = strlen(st.service_name);
+
+	if (flen + nlen + 2 > sizeof(rd->buffer)) {
+		free_init_status(&st);
+		errno = EPROTO;
+		return -1;
+	}
+
+	memcpy(rd->buffer, st.filename, flen + 1);
+	memcpy(rd->buffer + flen + 1, st.service_name, nlen + 1);
+	free_init_status(&st);
+
+	resp->state = st.state;
+	resp->exit_status = st.exit_status;
+	resp->id = st.id;
+	resp->filename = (char *)rd->buffer;
+	resp->service_name = (char *)rd->buffer + flen + 1;
+	return 1;
+}
+
+/* ask again in the old format if the batched request was ignored */
+static int recv_first_batch(int fd, init_status_reader_t *rd)
+{
+	int ret = init_socket_recv_batch(fd, rd);
+
+	if (ret != 0 && errno == EAGAIN) {
+		if (init_socket_send_request(fd, EIR_STATUS, rd->filter))
+			return -1;
+		rd->legacy = true;
+		ret = 0;
+	}
+
+	/* the old reply is read with the timeout, in case it never comes */
+	rd->fallback = false;
+
+	if (!rd->legacy && set_timeout(fd, 0))
+		return -1;
+
+	return ret;
+}
+
+int init_socket_recv_batch(int fd, init_status_reader_t *rd)
+{
+	init_status_batch_t hdr;
+	ssize_t ret;
+retry:
+	ret = recv(fd, rd->buffer, sizeof(rd->buffer), MSG_TRUNC);
+
+	if (ret < 0) {
+		if (errno == EINTR)
+			goto retry;
+		return -1;
+	}
+
+	if ((size_t)ret < sizeof(hdr) || (size_t)ret > sizeof(rd->buffer))
+		goto fail_proto;
+
+	memcpy(&hdr, rd->buffer, sizeof(hdr));
+
+	/* the server may use an older format than the one requested */
+	if (hdr.version == 0 || hdr.version > rd->version)
+		goto fail_proto;
+
+	rd->version = hdr.version;
+
+	rd->size = ret;
+	rd->offset = sizeof(hdr);
+	rd->count = be16toh(hdr.count);
+	rd->last = (hdr.flags & ISB_FLAG_LAST) != 0;
+	return 0;
+fail_proto:
+	errno = EPROTO;
+	return -1;
+}
+
+static void decode_usage(svc_usage_t *usage, const uint64_t *in)
+{
+	usage->utime = be64toh(in[0]);
+	usage->stime = be64toh(in[1]);
+	usage->maxrss = be64toh(in[2]);
+	usage->minflt = be64toh(in[3]);
+	usage->majflt = be64toh(in[4]);
+}
+
+int init_socket_read_status(int fd, init_status_reader_t *rd,
+			    init_status_t *resp)
+{
+	size_t flen, nlen, size, total;
+	init_status_record_t rec;
+	const char *str;
+
+	memset(resp, 0, sizeof(*resp));
+
+	if (rd->fallback && recv_first_batch(fd, rd))
+		return -1;
+
+	if (rd->legacy)
+		return rd->last ? 0 : read_legacy(fd, rd, resp);
+
+	while (rd->count == 0) {
+		if (rd->last)
+			return 0;
+		if (init_socket_recv_batch(fd, rd))
+			return -1;
+	}
+
+	/* fields missing from older versions of the record read as zero */
+	switch (rd->version) {
+	case 1:
+		size = INIT_STATUS_RECORD_V1;
+		break;
+	case 2:
+		size = INIT_STATUS_RECORD_V2;
+		break;
+	default:
+		size = sizeof(rec);
+		break;
+	}
+
+	if (rd->size - rd->offset < size)
+		goto fail_proto;
+
+	memset(&rec, 0, sizeof(rec));
+	memcpy(&rec, rd->buffer + rd->offset, size);
+
+	flen = be16toh(rec.fname_len);
+	nlen = be16toh(rec.name_len);
+	total = (size + flen + nlen + 2 + 3) & ~((size_t)3);
+
+	if (rd->size - rd->offset < total)
+		goto fail_proto;
+
+	str = (const char *)rd->buffer + rd->offset + size;
+
+	if (str[flen] != '\0' || str[flen + 1 + nlen] != '\0')
+		goto fail_proto;
+
+	resp->state = rec.state;
+	resp->exit_status = rec.exit_status;
+	resp->id = (int32_t)be32toh(rec.id);
+	resp->respawns = be16toh(rec.respawns);
+	resp->backoff = be32toh(rec.backoff);
+	resp->signal = rec.signal;
+	resp->core_dumped = (rec.flags & ISR_FLAG_CORE_DUMPED) != 0;
+	resp->run_time = be64toh(rec.run_time);
+	decode_usage(&resp->usage, rec.usage);
+	decode_usage(&resp->total_usage, rec.total_usage);
+	resp->filename = (char *)str;
+	resp->service_name = (char *)str + flen + 1;
+
+	rd->offset += total;
+	rd->count -= 1;
+	return 1;
+fail_proto:
+	errno = EPROTO;
+	return -1;
+}
@@ -0,0 +1,72 @@
+/* SPDX-License-Identifier: ISC */
+#include <stdint.h>
+#include <string.h>
+#include <endian.h>
+#include <errno.h>
+
+#include "initsock.h"
+
+int init_socket_request_timeline(int fd, init_status_reader_t *rd)
+{
+	rd->size = 0;
+	rd->offset = 0;
+	rd->count = 0;
+	rd->last = false;
+	rd->version = INIT_TIMELINE_VERSION;
+
+	return init_socket_send_request(fd, EIR_TIMELINE);
+}
+
+int init_socket_read_timeline(int fd, init_status_reader_t *rd,
+			      init_timeline_t *out)
+{
+	init_timeline_record_t rec;
+	size_t flen, nlen, total;
+	const char *str;
+	int i;
+
+	memset(out, 0, sizeof(*out));
+
+	while (rd->count == 0) {
+		if (rd->last)
+			return 0;
+		if (init_socket_recv_batch(fd, rd))
+			return -1;
+	}
+
+	if (rd->size - rd->offset < sizeof(rec))
+		goto fail_proto;
+
+	memcpy(&rec, rd->buffer + rd->offset, sizeof(rec));
+
+	flen = be16toh(rec.fname_len);
+	nlen = be16toh(rec.name_len);
+	total = (sizeof(rec) + flen + nlen + 2 + 3) & ~((size_t)3);
+
+	if (rd->size - rd->offset < total)
+		goto fail_proto;
+
+	str = (const char *)rd->buffer + rd->offset + sizeof(rec);
+
+	if (str[flen] != '\0' || str[flen + 1 + nlen] != '\0')
+		goto fail_proto;
+
+	out->state = rec.state;
+	out->type = rec.type;
+	out->target = rec.target;
+	out->id = (int32_t)be32toh(rec.id);
+	out->filename = str;
+	out->service_name = str + flen + 1;
+
+	for (i = 0; i < SVC_TS_MAX; ++i) {
+		out->mono[i] = be64toh(rec.mono[i]);
+		out->boot[i] = be64toh(rec.boot[i]);
+	}
+
+	rd->offset += total;
+	rd->count -= 1;
+	return 1;
+fail_proto:
+	errno = EPROTO;
+	return -1;
+}
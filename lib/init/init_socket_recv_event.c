@@ -0,0 +1,32 @@
+/* SPDX-License-Identifier: ISC */
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <endian.h>
+#include <errno.h>
+
+#include "initsock.h"
+
+int init_socket_recv_event(int fd, init_event_t *ev)
+{
+	init_response_event_t raw;
+	ssize_t ret;
+
+	ret = read(fd, &raw, sizeof(raw));
+	if (ret < 0)
+		return -1;
+
+	if ((size_t)ret < sizeof(raw)) {
+		errno = EPROTO;
+		return -1;
+	}
+
+	ev->old_state = raw.old_state;
+	ev->new_state = raw.new_state;
+	ev->exit_status = raw.exit_status;
+	ev->id = (int32_t)be32toh(raw.id);
+	ev->timestamp = be64toh(raw.timestamp);
+	return 0;
+}
@@ -0,0 +1,90 @@
+/* SPDX-License-Identifier: ISC */
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <endian.h>
+#include <errno.h>
+
+#include "initsock.h"
+
+typedef union {
+	init_request_t rq;
+	uint8_t raw[INIT_REQUEST_MAX];
+} match_request_t;
+
+static int send_match(int fd, match_request_t *req, size_t size)
+{
+	init_response_match_t resp;
+	ssize_t ret;
+
+	req->rq.arg.match.count = htobe16(req->rq.arg.match.count);
+	req->rq.arg.match.size = htobe16(size - sizeof(req->rq));
+retry_write:
+	ret = write(fd, req, size);
+	if (ret < 0) {
+		if (errno == EINTR)
+			goto retry_write;
+		return -1;
+	}
+retry_read:
+	ret = read(fd, &resp, sizeof(resp));
+	if (ret < 0) {
+		if (errno == EINTR)
+			goto retry_read;
+		return -1;
+	}
+
+	if ((size_t)ret < sizeof(resp)) {
+		errno = EPROTO;
+		return -1;
+	}
+
+	return be32toh(resp.count);
+}
+
+int init_socket_request_match(int fd, E_INIT_REQUEST rq,
+			      char *const patterns[], int count)
+{
+	size_t len, size = sizeof(init_request_t);
+	int i, ret, total = 0;
+	match_request_t req;
+
+	memset(&req.rq, 0, sizeof(req.rq));
+	req.rq.rq = rq;
+
+	for (i = 0; i < count; ++i) {
+		len = strlen(patterns[i]) + 1;
+
+		if (len > sizeof(req) - sizeof(req.rq)) {
+			errno = E2BIG;
+			return -1;
+		}
+
+		if (size + len > sizeof(req)) {
+			ret = send_match(fd, &req, size);
+			if (ret < 0)
+				return -1;
+
+			total += ret;
+			size = sizeof(req.rq);
+			memset(&req.rq, 0, sizeof(req.rq));
+			req.rq.rq = rq;
+		}
+
+		memcpy(req.raw + size, patterns[i], len);
+		size += len;
+		req.rq.arg.match.count += 1;
+	}
+
+	if (req.rq.arg.match.count > 0) {
+		ret = send_match(fd, &req, size);
+		if (ret < 0)
+			return -1;
+
+		total += ret;
+	}
+
+	return total;
+}
@@ -22,6 +22,10 @@ int init_socket_send_request(int fd, E_INIT_REQUEST rq, ...)
 	case EIR_STATUS:
 		request.arg.status.filter = va_arg(ap, E_SERVICE_STATE);
 		break;
+	case EIR_STATUS_BATCH:
+		request.arg.status.filter = va_arg(ap, E_SERVICE_STATE);
+		request.arg.status.version = INIT_STATUS_VERSION;
+		break;
 	case EIR_START:
 	case EIR_STOP:
 		request.arg.startstop.id = htobe32(va_arg(ap, int));
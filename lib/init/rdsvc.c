@@ -184,6 +184,469 @@ fail_limit:
 	return -1;
 }
 
+/* parse exactly two unsigned decimal numbers */
+static int parse_uint_pair(char *arg, unsigned int out[2], rdline_t *rd,
+			   const char *keyword)
+{
+	unsigned long value;
+	char *end;
+	int i;
+
+	if (try_pack_argv(arg, rd) != 2)
+		goto fail;
+
+	for (i = 0; i < 2; ++i) {
+		if (!isdigit(*arg))
+			goto fail;
+
+		errno = 0;
+		value = strtoul(arg, &end, 10);
+		if (errno != 0 || *end != '\0' || value > 0x7FFFFFFF)
+			goto fail;
+
+		out[i] = value;
+		arg = end + 1;
+	}
+
+	return 0;
+fail:
+	fprintf(stderr, "%s: %zu: expected two numbers after '%s'\n",
+		rd->filename, rd->lineno, keyword);
+	return -1;
+}
+
+static int svc_backoff(void *user, char *arg, rdline_t *rd)
+{
+	service_t *svc = user;
+	unsigned int value[2];
+
+	if (parse_uint_pair(arg, value, rd, "backoff"))
+		return -1;
+
+	/* a zero delay would never grow by doubling it */
+	if (value[0] == 0) {
+		fprintf(stderr, "%s: %zu: initial backoff must be at least "
+			"1 ms\n", rd->filename, rd->lineno);
+		return -1;
+	}
+
+	if (value[0] > value[1]) {
+		fprintf(stderr, "%s: %zu: initial backoff exceeds maximum\n",
+			rd->filename, rd->lineno);
+		return -1;
+	}
+
+	svc->backoff_min = value[0];
+	svc->backoff_max = value[1];
+	return 0;
+}
+
+static int svc_window(void *user, char *arg, rdline_t *rd)
+{
+	service_t *svc = user;
+	unsigned int value[2];
+
+	if (parse_uint_pair(arg, value, rd, "window"))
+		return -1;
+
+	svc->window_count = value[0];
+	svc->window_time = value[1];
+	return 0;
+}
+
+static int svc_ready(void *user, char *arg, rdline_t *rd)
+{
+	service_t *svc = user;
+
+	if (svc->flags & (SVC_FLAG_READY_NOTIFY | SVC_FLAG_READY_FILE)) {
+		fprintf(stderr, "%s: %zu: readiness respecified\n",
+			rd->filename, rd->lineno);
+		return -1;
+	}
+
+	if (strcmp(arg, "notify") == 0) {
+		svc->flags |= SVC_FLAG_READY_NOTIFY;
+		return 0;
+	}
+
+	if (strncmp(arg, "file", 4) != 0 || !isspace(arg[4]))
+		goto fail;
+
+	arg += 4;
+	while (isspace(*arg))
+		++arg;
+
+	if (try_unescape(arg, rd))
+		return -1;
+
+	if (*arg != '/')
+		goto fail;
+
+	svc->ready_file = try_strdup(arg, rd);
+	if (svc->ready_file == NULL)
+		return -1;
+
+	svc->flags |= SVC_FLAG_READY_FILE;
+	return 0;
+fail:
+	fprintf(stderr, "%s: %zu: expected 'notify' or 'file <absolute path>' "
+		"after 'ready'\n", rd->filename, rd->lineno);
+	return -1;
+}
+
+static int svc_readytimeout(void *user, char *arg, rdline_t *rd)
+{
+	service_t *svc = user;
+	unsigned long value;
+	char *end;
+
+	if (!isdigit(*arg))
+		goto fail;
+
+	errno = 0;
+	value = strtoul(arg, &end, 10);
+	if (errno != 0 || *end != '\0' || value > 0x7FFFFFFF)
+		goto fail;
+
+	svc->ready_timeout = value;
+	return 0;
+fail:
+	fprintf(stderr, "%s: %zu: expected a number of seconds after "
+		"'readytimeout'\n", rd->filename, rd->lineno);
+	return -1;
+}
+
+static bool is_port(const char *str)
+{
+	char *end;
+	long port;
+
+	if (!isdigit(*str))
+		return false;
+
+	port = strtol(str, &end, 10);
+	return *end == '\0' && port > 0 && port <= 65535;
+}
+
+static bool parse_id(const char *str, const char **end, unsigned long *id)
+{
+	char *ptr;
+
+	if (!isdigit(*str))
+		return false;
+
+	errno = 0;
+	*id = strtoul(str, &ptr, 10);
+	*end = ptr;
+	return errno == 0 && *id <= 0xFFFFFFFEUL;
+}
+
+/*
+	Turn the optional '<mode> [<uid>[:<gid>]]' of a unix socket into the
+	form svcsock_open expects: octal mode, uid and gid separated by
+	spaces, with the defaults filled in.
+*/
+static int socket_perm(const char *mode, const char *owner, char *out,
+		       size_t size)
+{
+	unsigned long m = 0600, uid = 0, gid = 0;
+	const char *end;
+	char *ptr;
+
+	if (mode != NULL) {
+		if (!isdigit(*mode))
+			return -1;
+
+		m = strtoul(mode, &ptr, 8);
+		if (*ptr != '\0' || m > 07777)
+			return -1;
+	}
+
+	if (owner != NULL) {
+		if (!parse_id(owner, &end, &uid))
+			return -1;
+
+		gid = uid;
+
+		if (*end == ':' && !parse_id(end + 1, &end, &gid))
+			return -1;
+
+		if (*end != '\0')
+			return -1;
+	}
+
+	snprintf(out, size, "%lo %lu %lu", m, uid, gid);
+	return 0;
+}
+
+static int svc_socket(void *user, char *arg, rdline_t *rd)
+{
+	const char *addr, *mode = NULL, *owner = NULL;
+	size_t used = 0, tlen, alen, plen;
+	service_t *svc = user;
+	char perm[64];
+	char *new;
+	int i, count;
+
+	if (svc->num_sockets == SVC_MAX_SOCKETS) {
+		fprintf(stderr, "%s: %zu: too many sockets\n",
+			rd->filename, rd->lineno);
+		return -1;
+	}
+
+	count = try_pack_argv(arg, rd);
+	if (count < 2)
+		goto fail;
+
+	tlen = strlen(arg);
+	addr = arg + tlen + 1;
+	alen = strlen(addr);
+	perm[0] = '\0';
+
+	if (count > 2)
+		mode = addr + alen + 1;
+	if (count > 3)
+		owner = mode + strlen(mode) + 1;
+
+	if (strcmp(arg, "unix") == 0) {
+		if (*addr != '/' || count > 4 ||
+		    socket_perm(mode, owner, perm, sizeof(perm))) {
+			goto fail;
+		}
+	} else if (strcmp(arg, "tcp") == 0 || strcmp(arg, "udp") == 0) {
+		if (count != 2 || !is_port(addr))
+			goto fail;
+	} else {
+		goto fail;
+	}
+
+	plen = strlen(perm);
+
+	for (i = 0; i < 3 * svc->num_sockets; ++i)
+		used += strlen(svc->sockets + used) + 1;
+
+	new = realloc(svc->sockets, used + tlen + alen + plen + 3);
+	if (new == NULL) {
+		fprintf(stderr, "%s: %zu: out of memory\n",
+			rd->filename, rd->lineno);
+		return -1;
+	}
+
+	memcpy(new + used, arg, tlen + alen + 2);
+	memcpy(new + used + tlen + alen + 2, perm, plen + 1);
+	svc->sockets = new;
+	svc->num_sockets += 1;
+	return 0;
+fail:
+	fprintf(stderr, "%s: %zu: expected 'unix <absolute path> [<mode> "
+		"[<uid>[:<gid>]]]', 'tcp <port>' or 'udp <port>' after "
+		"'socket'\n", rd->filename, rd->lineno);
+	return -1;
+}
+
+static int add_limit(service_t *svc, const char *file, const char *value,
+		     rdline_t *rd)
+{
+	size_t used = 0, flen = strlen(file) + 1, vlen = strlen(value) + 1;
+	char *new;
+	int i;
+
+	for (i = 0; i < 2 * svc->num_limits; ++i)
+		used += strlen(svc->limits + used) + 1;
+
+	new = realloc(svc->limits, used + flen + vlen);
+	if (new == NULL) {
+		fprintf(stderr, "%s: %zu: out of memory\n",
+			rd->filename, rd->lineno);
+		return -1;
+	}
+
+	memcpy(new + used, file, flen);
+	memcpy(new + used + flen, value, vlen);
+	svc->limits = new;
+	svc->num_limits += 1;
+	return 0;
+}
+
+static bool parse_ranged(const char *str, unsigned long min, unsigned long max,
+			 unsigned long *out)
+{
+	char *end;
+
+	if (!isdigit(*str))
+		return false;
+
+	errno = 0;
+	*out = strtoul(str, &end, 10);
+
+	return errno == 0 && *end == '\0' && *out >= min && *out <= max;
+}
+
+/* a number of bytes with an optional K, M, G or T suffix, or "max" */
+static bool parse_size(const char *str, char *out, size_t size)
+{
+	unsigned long long value;
+	const char *suffixes = "KMGT";
+	const char *unit;
+	int shift;
+	char *end;
+
+	if (strcmp(str, "max") == 0) {
+		snprintf(out, size, "max");
+		return true;
+	}
+
+	if (!isdigit(*str))
+		return false;
+
+	errno = 0;
+	value = strtoull(str, &end, 10);
+	if (errno != 0)
+		return false;
+
+	if (*end != '\0') {
+		unit = strchr(suffixes, toupper((unsigned char)*end));
+		if (unit == NULL || end[1] != '\0')
+			return false;
+
+		shift = 10 * (unit - suffixes + 1);
+		if (value > (~0ULL >> shift))
+			return false;
+
+		value <<= shift;
+	}
+
+	snprintf(out, size, "%llu", value);
+	return true;
+}
+
+static int svc_cpu(void *user, char *arg, rdline_t *rd)
+{
+	unsigned long weight, quota, period = 100000;
+	service_t *svc = user;
+	char value[64];
+	const char *val;
+	int count;
+
+	count = try_pack_argv(arg, rd);
+	if (count < 2)
+		goto fail;
+
+	val = arg + strlen(arg) + 1;
+
+	if (strcmp(arg, "weight") == 0 && count == 2) {
+		if (!parse_ranged(val, 1, 10000, &weight))
+			goto fail;
+
+		sprintf(value, "%lu", weight);
+		return add_limit(svc, "cpu.weight", value, rd);
+	}
+
+	if (strcmp(arg, "max") != 0 || count > 3)
+		goto fail;
+
+	if (count == 3 &&
+	    !parse_ranged(val + strlen(val) + 1, 1000, 1000000, &period)) {
+		goto fail;
+	}
+
+	if (strcmp(val, "max") == 0) {
+		sprintf(value, "max %lu", period);
+	} else if (parse_ranged(val, 1000, 0xFFFFFFFF, &quota)) {
+		sprintf(value, "%lu %lu", quota, period);
+	} else {
+		goto fail;
+	}
+
+	return add_limit(svc, "cpu.max", value, rd);
+fail:
+	fprintf(stderr, "%s: %zu: expected 'weight <1-10000>' or "
+		"'max <quota|max> [period]' after 'cpu'\n",
+		rd->filename, rd->lineno);
+	return -1;
+}
+
+static int svc_memory(void *user, char *arg, rdline_t *rd)
+{
+	service_t *svc = user;
+	char value[64];
+	const char *val;
+
+	if (try_pack_argv(arg, rd) != 2)
+		goto fail;
+
+	val = arg + strlen(arg) + 1;
+
+	if (!parse_size(val, value, sizeof(value)))
+		goto fail;
+
+	if (strcmp(arg, "high") == 0)
+		return add_limit(svc, "memory.high", value, rd);
+
+	if (strcmp(arg, "max") == 0)
+		return add_limit(svc, "memory.max", value, rd);
+fail:
+	fprintf(stderr, "%s: %zu: expected 'high <size>' or 'max <size>' "
+		"after 'memory'\n", rd->filename, rd->lineno);
+	return -1;
+}
+
+static int svc_io(void *user, char *arg, rdline_t *rd)
+{
+	unsigned long weight, major, minor, target;
+	service_t *svc = user;
+	char value[64], extra;
+	const char *val;
+	int count;
+
+	count = try_pack_argv(arg, rd);
+	if (count < 2)
+		goto fail;
+
+	val = arg + strlen(arg) + 1;
+
+	if (strcmp(arg, "weight") == 0 && count == 2) {
+		if (!parse_ranged(val, 1, 10000, &weight))
+			goto fail;
+
+		sprintf(value, "default %lu", weight);
+		return add_limit(svc, "io.weight", value, rd);
+	}
+
+	if (strcmp(arg, "latency") != 0 || count != 3)
+		goto fail;
+
+	if (sscanf(val, "%lu:%lu%c", &major, &minor, &extra) != 2 ||
+	    !parse_ranged(val + strlen(val) + 1, 1, 0xFFFFFFFF, &target)) {
+		goto fail;
+	}
+
+	sprintf(value, "%lu:%lu target=%lu", major, minor, target);
+	return add_limit(svc, "io.latency", value, rd);
+fail:
+	fprintf(stderr, "%s: %zu: expected 'weight <1-10000>' or "
+		"'latency <major>:<minor> <microseconds>' after 'io'\n",
+		rd->filename, rd->lineno);
+	return -1;
+}
+
+static int svc_start(void *user, char *arg, rdline_t *rd)
+{
+	service_t *svc = user;
+
+	if (strcmp(arg, "lazy") == 0) {
+		svc->flags |= SVC_FLAG_LAZY;
+	} else if (strcmp(arg, "immediate") == 0) {
+		svc->flags &= ~SVC_FLAG_LAZY;
+	} else {
+		fprintf(stderr, "%s: %zu: expected 'lazy' or 'immediate' "
+			"after 'start'\n", rd->filename, rd->lineno);
+		return -1;
+	}
+
+	return 0;
+}
+
 static int svc_target(void *user, char *arg, rdline_t *rd)
 {
 	service_t *svc = user;
@@ -212,6 +675,15 @@ static const cfg_param_t svc_params[] = {
 	{ "tty", 0, svc_tty },
 	{ "before", 0, svc_before },
 	{ "after", 0, svc_after },
+	{ "backoff", 0, svc_backoff },
+	{ "window", 0, svc_window },
+	{ "ready", 0, svc_ready },
+	{ "readytimeout", 0, svc_readytimeout },
+	{ "socket", 0, svc_socket },
+	{ "start", 0, svc_start },
+	{ "cpu", 0, svc_cpu },
+	{ "memory", 0, svc_memory },
+	{ "io", 0, svc_io },
 };
 
 service_t *rdsvc(int dirfd, const char *filename)
@@ -244,12 +716,29 @@ service_t *rdsvc(int dirfd, const char *filename)
 
 	memcpy(svc->name, filename, nlen);
 	svc->id = -1;
+	svc->pidfd = -1;
+	svc->notify_fd[0] = -1;
+	svc->notify_fd[1] = -1;
+	svc->cgroup_fd = -1;
+	svc->cgroup_events = -1;
+	svc->backoff_min = SVC_BACKOFF_MIN_DEFAULT;
+	svc->backoff_max = SVC_BACKOFF_MAX_DEFAULT;
+	svc->ready_timeout = SVC_READY_TIMEOUT_DEFAULT;
 
 	if (rdcfg(svc, &rd, svc_params,
 		  sizeof(svc_params) / sizeof(svc_params[0]))) {
 		goto fail;
 	}
 
+	if ((svc->flags & SVC_FLAG_LAZY) &&
+	    (svc->num_sockets == 0 || svc->type == SVC_WAIT ||
+	     !(svc->flags & SVC_FLAG_HAS_EXEC))) {
+		fprintf(stderr, "%s: 'start lazy' requires a socket, an exec "
+			"line and a service type other than 'wait'\n",
+			filename);
+		goto fail;
+	}
+
 out:
 	rdline_cleanup(&rd);
 	return svc;
@@ -1,79 +1,320 @@
 /* SPDX-License-Identifier: ISC */
 #include <stdbool.h>
+#include <stdint.h>
 #include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <stdio.h>
 
 #include "service.h"
 
-static bool has_dependencies(service_t *list, service_t *svc)
+#define NONE ((size_t)-1)
+
+typedef struct {
+	service_t *svc;
+	size_t chain;		/* next node in the same hash bucket */
+	size_t indegree;	/* number of unsorted dependencies */
+	size_t first_edge;	/* offset into the adjacency array */
+	size_t num_edges;
+} node_t;
+
+typedef struct {
+	node_t *nodes;
+	size_t count;
+
+	size_t *buckets;	/* name hash -> first node index */
+	size_t mask;
+
+	size_t *edges;		/* per node adjacency, nodes that follow it */
+	size_t num_edges;
+
+	size_t *heap;		/* ready nodes, ordered by input position */
+	size_t heap_size;
+} graph_t;
+
+static uint32_t hash_name(const char *str)
+{
+	uint32_t hash = 2166136261;
+
+	while (*str != '\0') {
+		hash ^= (uint8_t)*(str++);
+		hash *= 16777619;
+	}
+
+	return hash;
+}
+
+static size_t find_first(const graph_t *g, const char *name, size_t i)
+{
+	i = (i == NONE) ? g->buckets[hash_name(name) & g->mask] :
+			  g->nodes[i].chain;
+
+	while (i != NONE && strcmp(g->nodes[i].svc->name, name) != 0)
+		i = g->nodes[i].chain;
+
+	return i;
+}
+
+static void add_edge(graph_t *g, size_t from, size_t to, bool fill)
+{
+	node_t *n = g->nodes + from;
+
+	if (fill) {
+		g->edges[n->first_edge + n->num_edges] = to;
+		g->nodes[to].indegree += 1;
+	}
+
+	n->num_edges += 1;
+}
+
+/*
+	Walk all dependency edges of the graph. If fill is false, only the
+	out-degree of each node is counted. Otherwise, the adjacency array is
+	filled in and the in-degrees are computed.
+*/
+static void walk_edges(graph_t *g, bool fill)
 {
 	const char *ptr;
-	int i;
+	service_t *svc;
+	size_t i, j;
+	int k;
+
+	for (i = 0; i < g->count; ++i) {
+		svc = g->nodes[i].svc;
 
-	while (list != NULL) {
-		for (ptr = svc->after, i = 0; i < svc->num_after; ++i) {
-			if (!strcmp(ptr, list->name))
-				return true;
+		for (ptr = svc->after, k = 0; k < svc->num_after; ++k) {
+			for (j = find_first(g, ptr, NONE); j != NONE;
+			     j = find_first(g, ptr, j)) {
+				add_edge(g, j, i, fill);
+			}
 			ptr += strlen(ptr) + 1;
 		}
 
-		for (ptr = list->before, i = 0; i < list->num_before; ++i) {
-			if (!strcmp(ptr, svc->name))
-				return true;
+		for (ptr = svc->before, k = 0; k < svc->num_before; ++k) {
+			for (j = find_first(g, ptr, NONE); j != NONE;
+			     j = find_first(g, ptr, j)) {
+				add_edge(g, i, j, fill);
+			}
 			ptr += strlen(ptr) + 1;
 		}
+	}
+}
 
-		list = list->next;
+static void heap_push(graph_t *g, size_t idx)
+{
+	size_t i = g->heap_size++, parent;
+
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (g->heap[parent] < idx)
+			break;
+		g->heap[i] = g->heap[parent];
+		i = parent;
 	}
 
-	return false;
+	g->heap[i] = idx;
 }
 
-service_t *svc_tsort(service_t *list)
+static size_t heap_pop(graph_t *g)
 {
-	service_t *nl = NULL, *end = NULL;
-	service_t *svc, *prev;
-
-	while (list != NULL) {
-		/* remove first service without dependencies */
-		prev = NULL;
-		svc = list;
-
-		while (svc != NULL) {
-			if (has_dependencies(list, svc)) {
-				prev = svc;
-				svc = svc->next;
-			} else {
-				if (prev != NULL) {
-					prev->next = svc->next;
-				} else {
-					list = svc->next;
-				}
-				svc->next = NULL;
-				break;
-			}
+	size_t top = g->heap[0], last, i = 0, child;
+
+	last = g->heap[--g->heap_size];
+
+	for (;;) {
+		child = 2 * i + 1;
+		if (child >= g->heap_size)
+			break;
+		if (child + 1 < g->heap_size &&
+		    g->heap[child + 1] < g->heap[child]) {
+			++child;
 		}
+		if (last < g->heap[child])
+			break;
+		g->heap[i] = g->heap[child];
+		i = child;
+	}
+
+	if (g->heap_size > 0)
+		g->heap[i] = last;
+	return top;
+}
+
+static int graph_init(graph_t *g, service_t *list)
+{
+	size_t i, size, h, offset;
+	service_t *svc;
+
+	memset(g, 0, sizeof(*g));
+
+	for (svc = list; svc != NULL; svc = svc->next)
+		g->count += 1;
+
+	for (size = 16; size < 2 * g->count; size *= 2)
+		;
+
+	g->mask = size - 1;
+	g->nodes = calloc(g->count, sizeof(g->nodes[0]));
+	g->buckets = malloc(size * sizeof(g->buckets[0]));
+	g->heap = malloc(g->count * sizeof(g->heap[0]));
+
+	if (g->nodes == NULL || g->buckets == NULL || g->heap == NULL)
+		return -1;
+
+	for (i = 0; i < size; ++i)
+		g->buckets[i] = NONE;
 
-		/* cycle! */
-		if (svc == NULL) {
-			if (end == NULL) {
-				nl = list;
-			} else {
-				end->next = list;
+	for (svc = list, i = 0; svc != NULL; svc = svc->next, ++i)
+		g->nodes[i].svc = svc;
+
+	/* insert in reverse, so each bucket chain is in input order */
+	for (i = g->count; i-- > 0; ) {
+		h = hash_name(g->nodes[i].svc->name) & g->mask;
+		g->nodes[i].chain = g->buckets[h];
+		g->buckets[h] = i;
+	}
+
+	walk_edges(g, false);
+
+	for (i = 0, offset = 0; i < g->count; ++i) {
+		g->nodes[i].first_edge = offset;
+		offset += g->nodes[i].num_edges;
+		g->nodes[i].num_edges = 0;
+	}
+
+	g->num_edges = offset;
+	g->edges = malloc((offset > 0 ? offset : 1) * sizeof(g->edges[0]));
+	if (g->edges == NULL)
+		return -1;
+
+	walk_edges(g, true);
+	return 0;
+}
+
+static void graph_cleanup(graph_t *g)
+{
+	free(g->nodes);
+	free(g->buckets);
+	free(g->edges);
+	free(g->heap);
+}
+
+/*
+	Every node that could not be sorted has at least one unsorted
+	predecessor. Walking backwards along such edges must eventually
+	revisit a node, which closes a cycle that we report.
+*/
+static void report_cycle(graph_t *g)
+{
+	size_t i, j, k, start, *pred;
+	node_t *n;
+
+	pred = malloc(g->count * sizeof(pred[0]));
+	if (pred == NULL)
+		return;
+
+	for (i = 0; i < g->count; ++i)
+		pred[i] = NONE;
+
+	for (i = 0; i < g->count && g->nodes[i].indegree == 0; ++i)
+		;
+
+	start = i;
+
+	while (start < g->count && pred[start] == NONE) {
+		for (j = 0; j < g->count; ++j) {
+			n = g->nodes + j;
+
+			if (n->indegree == 0)
+				continue;
+
+			for (k = 0; k < n->num_edges; ++k) {
+				if (g->edges[n->first_edge + k] == start)
+					break;
 			}
-			errno = ELOOP;
+
+			if (k < n->num_edges)
+				break;
+		}
+
+		if (j == g->count)
 			break;
+
+		pred[start] = j;
+		start = j;
+	}
+
+	if (start < g->count && pred[start] != NONE) {
+		fputs("dependency cycle: ", stderr);
+
+		i = start;
+		do {
+			fprintf(stderr, "%s -> ", g->nodes[i].svc->fname);
+			i = pred[i];
+		} while (i != start);
+
+		fprintf(stderr, "%s\n", g->nodes[start].svc->fname);
+	}
+
+	free(pred);
+}
+
+service_t *svc_tsort(service_t *list)
+{
+	service_t *nl = NULL, **end = &nl;
+	bool cycle = false;
+	size_t i, j;
+	node_t *n;
+	graph_t g;
+
+	if (list == NULL)
+		return NULL;
+
+	if (graph_init(&g, list)) {
+		graph_cleanup(&g);
+		errno = ENOMEM;
+		return list;
+	}
+
+	for (i = 0; i < g.count; ++i) {
+		if (g.nodes[i].indegree == 0)
+			heap_push(&g, i);
+	}
+
+	while (g.heap_size > 0) {
+		n = g.nodes + heap_pop(&g);
+
+		*end = n->svc;
+		end = &n->svc->next;
+		n->svc = NULL;
+
+		for (j = 0; j < n->num_edges; ++j) {
+			i = g.edges[n->first_edge + j];
+
+			if (--(g.nodes[i].indegree) == 0)
+				heap_push(&g, i);
 		}
+	}
 
-		/* append to new list */
-		if (end == NULL) {
-			nl = end = svc;
-		} else {
-			end->next = svc;
-			end = svc;
+	/* cycle! append the remaining services in their input order */
+	for (i = 0; i < g.count; ++i) {
+		if (g.nodes[i].svc == NULL)
+			continue;
+
+		if (!cycle) {
+			report_cycle(&g);
+			cycle = true;
 		}
+
+		*end = g.nodes[i].svc;
+		end = &g.nodes[i].svc->next;
 	}
 
+	*end = NULL;
+	graph_cleanup(&g);
+
+	if (cycle)
+		errno = ELOOP;
 	return nl;
 }
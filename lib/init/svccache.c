@@ -0,0 +1,440 @@
+/* SPDX-License-Identifier: ISC */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <limits.h>
+#include <stdio.h>
+#include <fcntl.h>
+
+#include "service.h"
+
+#define CACHE_MAGIC 0x43435653	/* "SVCC" */
+#define CACHE_VERSION 7
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t key;
+	uint32_t count[TGT_MAX];	/* number of records per target */
+} cache_header_t;
+
+/*
+	Each record is followed by the strings it references, in the order
+	fname, name, desc, ctty, before, after, ready_file, sockets, limits.
+	A string length of zero encodes a NULL pointer, otherwise the length
+	includes the terminating null byte(s). The exec lines follow the
+	strings, each as an cache_exec_t with the packed argument vector
+	appended.
+*/
+typedef struct {
+	int32_t type;
+	int32_t target;
+	int32_t rspwn_limit;
+	uint32_t flags;
+	int32_t num_before;
+	int32_t num_after;
+	uint32_t num_exec;
+	uint32_t backoff_min;
+	uint32_t backoff_max;
+	uint32_t window_count;
+	uint32_t window_time;
+	uint32_t ready_timeout;
+	int32_t num_sockets;
+	int32_t num_limits;
+	uint32_t len[9];
+} cache_record_t;
+
+typedef struct {
+	int32_t argc;
+	uint32_t len;
+} cache_exec_t;
+
+typedef struct {
+	const uint8_t *ptr;
+	size_t size;
+} cursor_t;
+
+static size_t packed_size(const char *str, int count)
+{
+	const char *ptr = str;
+	int i;
+
+	if (str == NULL)
+		return 0;
+
+	for (i = 0; i < count; ++i)
+		ptr += strlen(ptr) + 1;
+
+	return ptr - str;
+}
+
+static size_t string_size(const char *str)
+{
+	return str == NULL ? 0 : strlen(str) + 1;
+}
+
+static int write_all(int fd, const void *data, size_t size)
+{
+	const uint8_t *ptr = data;
+	ssize_t ret;
+
+	while (size > 0) {
+		ret = write(fd, ptr, size);
+		if (ret < 0)
+			return -1;
+
+		ptr += ret;
+		size -= ret;
+	}
+
+	return 0;
+}
+
+static int store_service(int fd, const service_t *svc)
+{
+	const char *str[9];
+	cache_record_t rec;
+	cache_exec_t ce;
+	exec_t *e;
+	int i;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.type = svc->type;
+	rec.target = svc->target;
+	rec.rspwn_limit = svc->rspwn_limit;
+	rec.flags = svc->flags & ~SVC_FLAG_RUNTIME;
+	rec.num_before = svc->num_before;
+	rec.num_after = svc->num_after;
+	rec.num_sockets = svc->num_sockets;
+	rec.num_limits = svc->num_limits;
+	rec.backoff_min = svc->backoff_min;
+	rec.backoff_max = svc->backoff_max;
+	rec.window_count = svc->window_count;
+	rec.window_time = svc->window_time;
+	rec.ready_timeout = svc->ready_timeout;
+
+	str[0] = svc->fname;
+	str[1] = svc->name;
+	str[2] = svc->desc;
+	str[3] = svc->ctty;
+	str[4] = svc->before;
+	str[5] = svc->after;
+	str[6] = svc->ready_file;
+	str[7] = svc->sockets;
+	str[8] = svc->limits;
+
+	rec.len[0] = string_size(str[0]);
+	rec.len[1] = string_size(str[1]);
+	rec.len[2] = string_size(str[2]);
+	rec.len[3] = string_size(str[3]);
+	rec.len[4] = packed_size(str[4], svc->num_before);
+	rec.len[5] = packed_size(str[5], svc->num_after);
+	rec.len[6] = string_size(str[6]);
+	rec.len[7] = packed_size(str[7], 3 * svc->num_sockets);
+	rec.len[8] = packed_size(str[8], 2 * svc->num_limits);
+
+	for (e = svc->exec; e != NULL; e = e->next)
+		rec.num_exec += 1;
+
+	if (write_all(fd, &rec, sizeof(rec)))
+		return -1;
+
+	for (i = 0; i < 9; ++i) {
+		if (rec.len[i] > 0 && write_all(fd, str[i], rec.len[i]))
+			return -1;
+	}
+
+	for (e = svc->exec; e != NULL; e = e->next) {
+		ce.argc = e->argc;
+		ce.len = packed_size(e->args, e->argc);
+
+		if (write_all(fd, &ce, sizeof(ce)))
+			return -1;
+		if (write_all(fd, e->args, ce.len))
+			return -1;
+	}
+
+	return 0;
+}
+
+int svc_cache_store(const char *path, uint64_t key,
+		    const service_list_t *list)
+{
+	char tmppath[PATH_MAX];
+	cache_header_t hdr;
+	service_t *svc;
+	int i, fd;
+
+	if (snprintf(tmppath, sizeof(tmppath), "%s.XXXXXX", path) >=
+	    (int)sizeof(tmppath)) {
+		return -1;
+	}
+
+	fd = mkostemp(tmppath, O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = CACHE_MAGIC;
+	hdr.version = CACHE_VERSION;
+	hdr.key = key;
+
+	for (i = 0; i < TGT_MAX; ++i) {
+		for (svc = list->targets[i]; svc != NULL; svc = svc->next)
+			hdr.count[i] += 1;
+	}
+
+	if (write_all(fd, &hdr, sizeof(hdr)))
+		goto fail;
+
+	for (i = 0; i < TGT_MAX; ++i) {
+		for (svc = list->targets[i]; svc != NULL; svc = svc->next) {
+			if (store_service(fd, svc))
+				goto fail;
+		}
+	}
+
+	if (fchmod(fd, 0644) || close(fd)) {
+		fd = -1;
+		goto fail;
+	}
+
+	if (rename(tmppath, path)) {
+		fd = -1;
+		goto fail;
+	}
+
+	return 0;
+fail:
+	if (fd >= 0)
+		close(fd);
+	unlink(tmppath);
+	return -1;
+}
+
+static const void *take(cursor_t *c, size_t size)
+{
+	const void *ret = c->ptr;
+
+	if (size > c->size)
+		return NULL;
+
+	c->ptr += size;
+	c->size -= size;
+	return ret;
+}
+
+static int take_string(cursor_t *c, size_t len, char **out)
+{
+	const char *str;
+
+	*out = NULL;
+	if (len == 0)
+		return 0;
+
+	str = take(c, len);
+	if (str == NULL || str[len - 1] != '\0')
+		return -1;
+
+	*out = malloc(len);
+	if (*out == NULL)
+		return -1;
+
+	memcpy(*out, str, len);
+	return 0;
+}
+
+static bool check_packed(const char *str, size_t len, int count)
+{
+	size_t i;
+
+	if (str == NULL)
+		return count == 0;
+
+	for (i = 0; i < len; ++i) {
+		if (str[i] == '\0')
+			--count;
+	}
+
+	return count <= 0;
+}
+
+static service_t *load_service(cursor_t *c, int target)
+{
+	const cache_exec_t *ceptr;
+	cache_record_t rec;
+	exec_t *e, **end;
+	cache_exec_t ce;
+	service_t *svc;
+	const void *ptr;
+	uint32_t i;
+
+	ptr = take(c, sizeof(rec));
+	if (ptr == NULL)
+		return NULL;
+
+	memcpy(&rec, ptr, sizeof(rec));
+
+	if (rec.target != target || rec.len[0] == 0 || rec.len[1] == 0)
+		return NULL;
+
+	if (rec.len[1] > c->size)
+		return NULL;
+
+	svc = calloc(1, sizeof(*svc) + rec.len[1]);
+	if (svc == NULL)
+		return NULL;
+
+	svc->type = rec.type;
+	svc->target = rec.target;
+	svc->rspwn_limit = rec.rspwn_limit;
+	svc->flags = rec.flags;
+	svc->num_before = rec.num_before;
+	svc->num_after = rec.num_after;
+	svc->num_sockets = rec.num_sockets;
+	svc->num_limits = rec.num_limits;
+	svc->backoff_min = rec.backoff_min;
+	svc->backoff_max = rec.backoff_max;
+	svc->window_count = rec.window_count;
+	svc->window_time = rec.window_time;
+	svc->ready_timeout = rec.ready_timeout;
+	svc->id = -1;
+	svc->pidfd = -1;
+	svc->notify_fd[0] = -1;
+	svc->notify_fd[1] = -1;
+	svc->cgroup_fd = -1;
+	svc->cgroup_events = -1;
+
+	if (take_string(c, rec.len[0], &svc->fname))
+		goto fail;
+
+	ptr = take(c, rec.len[1]);
+	if (ptr == NULL || ((const char *)ptr)[rec.len[1] - 1] != '\0')
+		goto fail;
+	memcpy(svc->name, ptr, rec.len[1]);
+
+	if (take_string(c, rec.len[2], &svc->desc))
+		goto fail;
+	if (take_string(c, rec.len[3], &svc->ctty))
+		goto fail;
+	if (take_string(c, rec.len[4], &svc->before))
+		goto fail;
+	if (take_string(c, rec.len[5], &svc->after))
+		goto fail;
+	if (take_string(c, rec.len[6], &svc->ready_file))
+		goto fail;
+	if (take_string(c, rec.len[7], &svc->sockets))
+		goto fail;
+	if (take_string(c, rec.len[8], &svc->limits))
+		goto fail;
+
+	if (svc->num_sockets < 0 || svc->num_sockets > SVC_MAX_SOCKETS ||
+	    svc->num_limits < 0) {
+		goto fail;
+	}
+
+	if (!check_packed(svc->before, rec.len[4], svc->num_before) ||
+	    !check_packed(svc->after, rec.len[5], svc->num_after) ||
+	    !check_packed(svc->sockets, rec.len[7], 3 * svc->num_sockets) ||
+	    !check_packed(svc->limits, rec.len[8], 2 * svc->num_limits)) {
+		goto fail;
+	}
+
+	end = &svc->exec;
+
+	for (i = 0; i < rec.num_exec; ++i) {
+		ceptr = take(c, sizeof(ce));
+		if (ceptr == NULL)
+			goto fail;
+		memcpy(&ce, ceptr, sizeof(ce));
+
+		ptr = take(c, ce.len);
+		if (ptr == NULL || ce.len == 0)
+			goto fail;
+
+		if (!check_packed(ptr, ce.len, ce.argc))
+			goto fail;
+
+		e = calloc(1, sizeof(*e) + ce.len);
+		if (e == NULL)
+			goto fail;
+
+		e->argc = ce.argc;
+		memcpy(e->args, ptr, ce.len);
+
+		*end = e;
+		end = &e->next;
+	}
+
+	return svc;
+fail:
+	delsvc(svc);
+	return NULL;
+}
+
+int svc_cache_load(const char *path, uint64_t key, service_list_t *list)
+{
+	service_t *svc, **end;
+	cache_header_t hdr;
+	struct stat sb;
+	uint32_t j;
+	void *map;
+	cursor_t c;
+	int i, fd;
+
+	for (i = 0; i < TGT_MAX; ++i)
+		list->targets[i] = NULL;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &sb) || (size_t)sb.st_size < sizeof(hdr)) {
+		close(fd);
+		return -1;
+	}
+
+	map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED)
+		return -1;
+
+	c.ptr = map;
+	c.size = sb.st_size;
+
+	memcpy(&hdr, take(&c, sizeof(hdr)), sizeof(hdr));
+
+	if (hdr.magic != CACHE_MAGIC || hdr.version != CACHE_VERSION ||
+	    hdr.key != key) {
+		goto fail;
+	}
+
+	for (i = 0; i < TGT_MAX; ++i) {
+		end = &list->targets[i];
+
+		for (j = 0; j < hdr.count[i]; ++j) {
+			svc = load_service(&c, i);
+			if (svc == NULL)
+				goto fail;
+
+			*end = svc;
+			end = &svc->next;
+		}
+	}
+
+	if (c.size != 0)
+		goto fail;
+
+	munmap(map, sb.st_size);
+	return 0;
+fail:
+	munmap(map, sb.st_size);
+	del_svc_list(list);
+	return -1;
+}
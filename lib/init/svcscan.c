@@ -1,7 +1,10 @@
 /* SPDX-License-Identifier: ISC */
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stddef.h>
+#include <stdlib.h>
 #include <dirent.h>
 #include <string.h>
 #include <errno.h>
@@ -10,31 +13,79 @@
 #include <ctype.h>
 
 #include "service.h"
+#include "config.h"
 
-int svcscan(const char *directory, service_list_t *list)
+#define SVCCACHE SVCCACHEDIR "/svccache"
+
+typedef struct {
+	char **names;
+	size_t count;
+	size_t max;
+	uint64_t key;
+} scan_t;
+
+static void hash_bytes(scan_t *scan, const void *data, size_t size)
+{
+	const uint8_t *ptr = data;
+
+	while (size--) {
+		scan->key ^= *(ptr++);
+		scan->key *= 1099511628211ULL;
+	}
+}
+
+static void hash_stat(scan_t *scan, const struct stat *sb)
+{
+	hash_bytes(scan, &sb->st_dev, sizeof(sb->st_dev));
+	hash_bytes(scan, &sb->st_ino, sizeof(sb->st_ino));
+	hash_bytes(scan, &sb->st_mode, sizeof(sb->st_mode));
+	hash_bytes(scan, &sb->st_size, sizeof(sb->st_size));
+	hash_bytes(scan, &sb->st_mtim, sizeof(sb->st_mtim));
+}
+
+static int add_name(scan_t *scan, const char *name)
+{
+	size_t max = scan->max ? scan->max * 2 : 32;
+	char **new;
+
+	if (scan->count == scan->max) {
+		new = realloc(scan->names, max * sizeof(new[0]));
+		if (new == NULL)
+			return -1;
+
+		scan->names = new;
+		scan->max = max;
+	}
+
+	scan->names[scan->count] = strdup(name);
+	if (scan->names[scan->count] == NULL)
+		return -1;
+
+	scan->count += 1;
+	return 0;
+}
+
+/*
+	Gather the names of all service files in the directory. The cache
+	key is derived from the directory itself, the names of the files and
+	the stat data of the files and, for symlinks, of their targets.
+*/
+static int scan_directory(const char *directory, DIR *dir, scan_t *scan)
 {
-	int i, dfd, type, ret = 0;
+	int type, dfd = dirfd(dir), ret = 0;
 	struct dirent *ent;
 	const char *ptr;
-	service_t *svc;
 	struct stat sb;
-	DIR *dir;
 
-	for (i = 0; i < TGT_MAX; ++i)
-		list->targets[i] = NULL;
+	scan->key = 14695981039346656037ULL;
+	hash_bytes(scan, directory, strlen(directory) + 1);
 
-	dir = opendir(directory);
-	if (dir == NULL) {
+	if (fstat(dfd, &sb)) {
 		perror(directory);
 		return -1;
 	}
 
-	dfd = dirfd(dir);
-	if (dfd < 0) {
-		perror(directory);
-		closedir(dir);
-		return -1;
-	}
+	hash_stat(scan, &sb);
 
 	for (;;) {
 		errno = 0;
@@ -66,7 +117,52 @@ int svcscan(const char *directory, service_list_t *list)
 		if (type != S_IFREG && type != S_IFLNK)
 			continue;
 
-		svc = rdsvc(dfd, ent->d_name);
+		hash_bytes(scan, ent->d_name, strlen(ent->d_name) + 1);
+		hash_stat(scan, &sb);
+
+		if (type == S_IFLNK) {
+			if (fstatat(dfd, ent->d_name, &sb, 0))
+				memset(&sb, 0, sizeof(sb));
+			hash_stat(scan, &sb);
+		}
+
+		if (add_name(scan, ent->d_name)) {
+			fputs("out of memory\n", stderr);
+			return -1;
+		}
+	}
+
+	return ret;
+}
+
+int svcscan(const char *directory, service_list_t *list)
+{
+	bool cacheable = true;
+	int i, ret = 0;
+	service_t *svc;
+	scan_t scan;
+	size_t j;
+	DIR *dir;
+
+	for (i = 0; i < TGT_MAX; ++i)
+		list->targets[i] = NULL;
+
+	dir = opendir(directory);
+	if (dir == NULL) {
+		perror(directory);
+		return -1;
+	}
+
+	memset(&scan, 0, sizeof(scan));
+
+	if (scan_directory(directory, dir, &scan)) {
+		ret = -1;
+	} else if (svc_cache_load(SVCCACHE, scan.key, list) == 0) {
+		goto out;
+	}
+
+	for (j = 0; j < scan.count; ++j) {
+		svc = rdsvc(dirfd(dir), scan.names[j]);
 		if (svc == NULL) {
 			ret = -1;
 			continue;
@@ -86,9 +182,16 @@ int svcscan(const char *directory, service_list_t *list)
 		if (errno != 0) {
 			fprintf(stderr, "sorting services read from %s: %s\n",
 				directory, strerror(errno));
+			cacheable = false;
 		}
 	}
 
+	if (ret == 0 && cacheable)
+		svc_cache_store(SVCCACHE, scan.key, list);
+out:
+	for (j = 0; j < scan.count; ++j)
+		free(scan.names[j]);
+	free(scan.names);
 	closedir(dir);
 	return ret;
 }